@@ -0,0 +1,80 @@
+#!/bin/bash
+
+# Run bench_suite on every compiled backend (build_openmp, build_threads, build_cuda from buildAll.sh)
+# and every thread count, appending one JSON line per run to the output file.
+
+# Function to display usage information
+usage() {
+    echo "Usage: $0 [-t <threads>] [-n <tets>] [-p <photons>] [-o <output.jsonl>] [-h]"
+    echo "  -t <threads>         Comma-separated thread counts for host backends (default: powers of two up to nproc)"
+    echo "  -n <tets>            Comma-separated target tet counts (default: 1000,10000,100000,1000000)"
+    echo "  -p <photons>         Photons per measurement (default: 100000)"
+    echo "  -o <output.jsonl>    Output file, results are appended (default: bench_results/<git describe>.jsonl)"
+    echo "  -h                   Display this help message"
+    exit 1
+}
+
+# Default values
+NPROC=$(nproc)
+THREADS=""
+for ((t = 1; t < NPROC; t *= 2)); do THREADS+="$t,"; done
+THREADS+="$NPROC"
+TETS="1000,10000,100000,1000000"
+PHOTONS=100000
+LABEL=$(git describe --always --dirty 2>/dev/null || echo unknown)
+OUTPUT="bench_results/${LABEL}.jsonl"
+
+# Parse command line arguments
+while getopts ":t:n:p:o:h" opt; do
+    case ${opt} in
+        t )
+            THREADS=$OPTARG
+            ;;
+        n )
+            TETS=$OPTARG
+            ;;
+        p )
+            PHOTONS=$OPTARG
+            ;;
+        o )
+            OUTPUT=$OPTARG
+            ;;
+        h )
+            usage
+            ;;
+        \? )
+            echo "Invalid option: -$OPTARG" 1>&2
+            usage
+            ;;
+        : )
+            echo "Invalid option: -$OPTARG requires an argument." 1>&2
+            usage
+            ;;
+    esac
+done
+shift $((OPTIND -1))
+
+mkdir -p "$(dirname "$OUTPUT")"
+FOUND=0
+for BACKEND in openmp threads cuda; do
+    BENCH="build_${BACKEND}/src/bench_suite"
+    [[ -x "$BENCH" ]] || continue
+    FOUND=1
+    ARGS="--tets $TETS --photons $PHOTONS --out $OUTPUT --label $LABEL"
+    if [[ "$BACKEND" == "cuda" ]]; then
+        echo "Running $BENCH"
+        $BENCH $ARGS || { echo "bench_suite failed on $BACKEND"; exit 1; }
+        continue
+    fi
+    for T in ${THREADS//,/ }; do
+        echo "Running $BENCH with $T threads"
+        OMP_PROC_BIND=spread OMP_PLACES=threads $BENCH --kokkos-num-threads=$T $ARGS ||
+            { echo "bench_suite failed on $BACKEND with $T threads"; exit 1; }
+    done
+done
+
+if [[ $FOUND -eq 0 ]]; then
+    echo "Error: no bench_suite found, build a backend first with buildAll.sh"
+    exit 1
+fi
+echo "Results appended to $OUTPUT"
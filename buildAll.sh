@@ -2,9 +2,12 @@
 
 # Function to display usage information
 usage() {
-    echo "Usage: $0 [-o <openmp|threads|cuda>] [-c <custom_kokkos_path>] [-h]"
+    echo "Usage: $0 [-o <openmp|threads|cuda>] [-c <custom_kokkos_path>] [-d] [-i] [-m] [-h]"
     echo "  -o <backend>         Specify the backend (openmp, threads, cuda)"
     echo "  -c <path>            Specify a custom Kokkos installation path"
+    echo "  -d                   Debug build with Kokkos_ENABLE_DEBUG (bounds checks and KOKKOS_ASSERT)"
+    echo "  -i                   Count hot-path transport events (MC_INSTRUMENT), printed after each run"
+    echo "  -m                   Also build the MPI multi-process driver mc_mpi (MC_MPI, needs an MPI installation)"
     echo "  -h                   Display this help message"
     exit 1
 }
@@ -12,9 +15,12 @@ usage() {
 # Default values
 BACKEND=""
 CUSTOM_KOKKOS_PATH=""
+DEBUG=0
+INSTRUMENT=0
+MPI=0
 
 # Parse command line arguments
-while getopts ":o:c:h" opt; do
+while getopts ":o:c:dimh" opt; do
     case ${opt} in
         o )
             BACKEND=$OPTARG
@@ -22,6 +28,15 @@ while getopts ":o:c:h" opt; do
         c )
             CUSTOM_KOKKOS_PATH=$OPTARG
             ;;
+        d )
+            DEBUG=1
+            ;;
+        i )
+            INSTRUMENT=1
+            ;;
+        m )
+            MPI=1
+            ;;
         h )
             usage
             ;;
@@ -66,7 +81,17 @@ esac
 if [[ -n "$CUSTOM_KOKKOS_PATH" ]]; then
     CMAKE_CMD+=" -DKokkos_ROOT=$CUSTOM_KOKKOS_PATH"
 fi
-CMAKE_CMD+=" -DKokkos_ENABLE_DEBUG=ON"
+if [[ $DEBUG -eq 1 ]]; then
+    CMAKE_CMD+=" -DCMAKE_BUILD_TYPE=Debug -DKokkos_ENABLE_DEBUG=ON"
+else
+    CMAKE_CMD+=" -DCMAKE_BUILD_TYPE=Release"
+fi
+if [[ $INSTRUMENT -eq 1 ]]; then
+    CMAKE_CMD+=" -DMC_INSTRUMENT=ON"
+fi
+if [[ $MPI -eq 1 ]]; then
+    CMAKE_CMD+=" -DMC_MPI=ON"
+fi
 # Print CMake command for debugging
 echo "Running CMake command: $CMAKE_CMD"
 
@@ -0,0 +1,95 @@
+#ifndef COLLECT_H
+#define COLLECT_H
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "Mesh.h"
+
+enum class CollectType
+{
+    EMIT       = 0,
+    COLLECT    = 1,
+    OUTOFRANGE = 2,
+    IGNORE     = -1
+};
+
+// 收集策略作为transpose_core的模板参数, 在编译期静态分派, 没有虚函数和间接调用.
+// 自定义策略只需要提供:
+//   KOKKOS_INLINE_FUNCTION CollectType GetCollectType(Index tet) const;
+// 策略对象按值捕获进kernel, 其中的数据必须能在设备上访问.
+
+// 默认策略: 每个四面体一个字节的标签, 查询只有一次字节读取.
+// 标签在host上由区域(NETGEN材料编号)和边界(bcnr)信息一次性构建
+class TetLabelCollect
+{
+   public:
+    Kokkos::View<uint8_t *, ExecSpace> labels;
+
+    TetLabelCollect() = default;
+    // 初始时所有四面体都是IGNORE
+    explicit TetLabelCollect(const TetMesh &mesh) : labels("collectLabels", mesh.NumTets()) { Reset(); }
+
+    KOKKOS_INLINE_FUNCTION
+    static uint8_t Encode(CollectType type) { return (uint8_t)(int8_t)type; }
+    KOKKOS_INLINE_FUNCTION
+    static CollectType Decode(uint8_t label) { return (CollectType)(int8_t)label; }
+
+    KOKKOS_INLINE_FUNCTION
+    CollectType GetCollectType(Index tet) const { return Decode(labels(tet)); }
+
+    void Reset() { Kokkos::deep_copy(labels, Encode(CollectType::IGNORE)); }
+    // 区域: NETGEN材料编号为domain的所有四面体
+    void SetDomain(const TetMesh &mesh, int domain, CollectType type)
+    {
+        auto labels_        = labels;
+        auto tetMaterials   = mesh.tetMaterials;
+        const uint8_t label = Encode(type);
+        Kokkos::parallel_for(
+            "CollectSetDomain", Kokkos::RangePolicy<ExecSpace>(0, mesh.NumTets()), KOKKOS_LAMBDA(const Index i)
+            {
+                if (tetMaterials(i) == domain) labels_(i) = label;
+            });
+    }
+    // 边界: 至少有一个面属于bcnr表面单元的四面体, 光子进入这些四面体时按type处理.
+    // 只有网格外边界上的面记录了表面单元, bcnr只出现在内部界面上(或不存在)时抛出异常
+    void SetBoundary(const TetMesh &mesh, int bcnr, CollectType type)
+    {
+        auto labels_        = labels;
+        const uint8_t label = Encode(type);
+        Index matched       = 0;
+        Kokkos::parallel_reduce(
+            "CollectSetBoundary", Kokkos::RangePolicy<ExecSpace>(0, mesh.NumTets()),
+            KOKKOS_LAMBDA(const Index i, Index &localMatched)
+            {
+                for (int f = 0; f < 4; f++)
+                {
+                    const Index s = TetMesh::BoundarySurface(mesh.faceNeighbors(i)[f]);
+                    if (s >= 0 && mesh.surfaceElements(s).bcnr == bcnr)
+                    {
+                        labels_(i) = label;
+                        localMatched++;
+                        return;
+                    }
+                }
+            },
+            matched);
+        if (matched == 0)
+        {
+            throw std::runtime_error("bcnr " + std::to_string(bcnr) + "不在网格的外边界上, 按边界收集不会生效");
+        }
+    }
+    // 按编号逐个指定
+    void SetTets(const std::vector<Index> &tets, CollectType type)
+    {
+        Kokkos::View<Index *, ExecSpace> tets_d("collectTets", tets.size());
+        Kokkos::deep_copy(tets_d, Kokkos::View<const Index *, Kokkos::HostSpace,
+                                               Kokkos::MemoryTraits<Kokkos::Unmanaged>>(tets.data(), tets.size()));
+        auto labels_        = labels;
+        const uint8_t label = Encode(type);
+        Kokkos::parallel_for(
+            "CollectSetTets", Kokkos::RangePolicy<ExecSpace>(0, tets.size()),
+            KOKKOS_LAMBDA(const size_t k) { labels_(tets_d(k)) = label; });
+    }
+};
+#endif
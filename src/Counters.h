@@ -0,0 +1,102 @@
+#ifndef COUNTERS_H
+#define COUNTERS_H
+#include <cstdint>
+#include <type_traits>
+#include "Utils.h"
+
+// 传输热路径的计数, 用于分析一次运行的时间花在哪里. 编译时定义MC_INSTRUMENT(CMake选项同名)才开启;
+// 关闭时transpose_core持有空的NoCounters, 计数调用都是空函数, 传输kernel仍为parallel_for, 没有任何开销
+#ifdef MC_INSTRUMENT
+constexpr bool INSTRUMENT = true;
+#else
+constexpr bool INSTRUMENT = false;
+#endif
+
+enum class Counter : int
+{
+    PHOTONS,           // 发射的光子数
+    STEPS,             // 飞行段数(Fly调用次数), 每段走到出射面或作用点
+    CROSSINGS,         // 网格内部面的穿越次数(DealWithFace)
+    REFLECTIONS,       // 界面上的全反射和菲涅尔反射
+    LOCATE_FALLBACKS,  // 发射时起始四面体未指定或错误, 退回空间索引FindCurPyramid查找
+    WALK_FAILURES,     // GetNextPyramid失败, 光子被终止
+    MOVE_LIMIT,        // Move中穿面次数达到MAX_ITER, 剩余自由程被丢弃
+    RUN_LIMIT,         // run中Move次数达到MAX_ITER, 光子被终止
+    COUNT
+};
+
+typedef struct TransportCounters
+{
+    uint64_t values[(int)Counter::COUNT] = {};
+    KOKKOS_INLINE_FUNCTION
+    void Add(Counter counter, uint64_t n = 1) { values[(int)counter] += n; }
+    KOKKOS_INLINE_FUNCTION
+    uint64_t operator[](Counter counter) const { return values[(int)counter]; }
+    KOKKOS_INLINE_FUNCTION
+    TransportCounters& operator+=(const TransportCounters& o)
+    {
+        for (int c = 0; c < (int)Counter::COUNT; c++) values[c] += o.values[c];
+        return *this;
+    }
+    // 在host上打印总数和每个光子的平均数
+    void Print() const
+    {
+        static const char* names[(int)Counter::COUNT] = {"photons",          "steps",         "crossings",
+                                                         "reflections",      "locate fallbacks", "walk failures",
+                                                         "MAX_ITER in Move", "MAX_ITER in run"};
+        const uint64_t photons = values[(int)Counter::PHOTONS];
+        Kokkos::printf("[传输计数]\n");
+        for (int c = 0; c < (int)Counter::COUNT; c++)
+        {
+            Kokkos::printf("  %-18s %14llu  %12.4f/photon\n", names[c], (unsigned long long)values[c],
+                           photons ? (double)values[c] / (double)photons : 0.0);
+        }
+    }
+} TransportCounters;
+namespace Kokkos
+{
+template <>
+struct reduction_identity<TransportCounters>
+{
+    KOKKOS_FORCEINLINE_FUNCTION static TransportCounters sum() { return TransportCounters(); }
+};
+}  // namespace Kokkos
+// 编译掉计数时使用, 不占寄存器, 所有操作都不产生代码
+typedef struct NoCounters
+{
+    KOKKOS_INLINE_FUNCTION
+    void Add(Counter, uint64_t = 1) {}
+    KOKKOS_INLINE_FUNCTION
+    NoCounters& operator+=(const NoCounters&) { return *this; }
+} NoCounters;
+using Counters = std::conditional_t<INSTRUMENT, TransportCounters, NoCounters>;
+
+// 关闭计数时把functor(i, counters)包装成普通的parallel_for functor
+template <class Functor, class IndexType>
+struct UncountedFunctor
+{
+    Functor functor;
+    KOKKOS_INLINE_FUNCTION
+    void operator()(const IndexType i) const
+    {
+        NoCounters counters;
+        functor(i, counters);
+    }
+};
+// 带计数的parallel_for: functor的签名为(i, Counters&). 开启计数时用归约把各线程的计数累加到total,
+// 关闭时为普通的parallel_for, total不变
+template <class Policy, class Functor>
+void CountedFor(const char* label, const Policy& policy, const Functor& functor, TransportCounters& total)
+{
+    if constexpr (INSTRUMENT)
+    {
+        TransportCounters sum;
+        Kokkos::parallel_reduce(label, policy, functor, Kokkos::Sum<TransportCounters>(sum));
+        total += sum;
+    }
+    else
+    {
+        Kokkos::parallel_for(label, policy, UncountedFunctor<Functor, typename Policy::index_type>{functor});
+    }
+}
+#endif
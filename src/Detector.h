@@ -0,0 +1,205 @@
+#ifndef DETECTOR_H
+#define DETECTOR_H
+#include <stdexcept>
+#include <vector>
+#include "Mesh.h"
+#include "Transpose_core.h"
+
+// 探测器定义, 运行时给出, 不需要重新编译kernel
+// 从边界离开的光子同时满足 边界面集合/环形区域/接收角/时间窗 条件时, 按(出射点半径, 飞行时间)计入二维直方图;
+// 每个半径格上的时间分布即时域测量的TPSF
+typedef struct Detector
+{
+    int bcnr = -1;                // 只接收从该bcnr(NETGEN surfaceelements)的表面单元出射的光子, -1 表示任意边界面
+    Point center{0, 0, 0};        // 环形区域的中心
+    Vec3f normal{0, 0, 1};        // 探测面的单位外法向, 半径在垂直于normal的平面内量取
+    Scalar rMin     = 0;          // 环形区域 [rMin, rMax)
+    Scalar rMax     = REALMAX;
+    Scalar na       = 1;          // 数值孔径 n_out·sinθ, n_out为环境介质(材料0)的折射率; na>=n_out 时接收所有朝外出射的光子
+    int numBins     = 1;          // [rMin, rMax) 上均匀划分的半径格数
+    Scalar tMin     = 0;          // 时间窗 [tMin, tMax)(ns); pathlength为true时为几何路径长度窗
+    Scalar tMax     = REALMAX;
+    int numTimeBins = 1;          // [tMin, tMax) 上均匀划分的时间格数
+    bool pathlength = false;      // true 时按几何路径长度而不是飞行时间分格
+    // 以下由DetectorSet填写
+    int offset = 0;               // 在直方图数组中的起始位置
+} Detector;
+
+// 探测器集合: 每批传输结束后对结果做一次数组归约, 只把直方图(几KB)拷回host累加
+class DetectorSet
+{
+   public:
+    Kokkos::View<Detector *, ExecSpace> detectors;
+    // 所有探测器的直方图, 探测器d的第k个半径格第t个时间格为 offset + k * numTimeBins + t
+    Kokkos::View<Accum *, Kokkos::HostSpace> histogram;
+
+    DetectorSet() = default;
+    explicit DetectorSet(std::vector<Detector> list)
+    {
+        int offset = 0;
+        for (Detector &d : list)
+        {
+            if (d.numBins < 1 || (d.numBins > 1 && d.rMax >= REALMAX) || d.rMax <= d.rMin)
+            {
+                throw std::runtime_error("探测器的半径范围或分格数无效");
+            }
+            if (d.numTimeBins < 1 || (d.numTimeBins > 1 && d.tMax >= REALMAX) || d.tMax <= d.tMin)
+            {
+                throw std::runtime_error("探测器的时间窗或时间格数无效");
+            }
+            d.offset = offset;
+            offset += d.numBins * d.numTimeBins;
+        }
+        m_host    = list;
+        detectors = Kokkos::View<Detector *, ExecSpace>("detectors", list.size());
+        Kokkos::deep_copy(detectors, Kokkos::View<Detector *, Kokkos::HostSpace,
+                                                  Kokkos::MemoryTraits<Kokkos::Unmanaged>>(list.data(), list.size()));
+        histogram = Kokkos::View<Accum *, Kokkos::HostSpace>("detectorHistogram", offset);
+    }
+    // 探测器相同、直方图独立的副本
+    DetectorSet Clone() const { return DetectorSet(m_host); }
+    bool Empty() const { return m_host.empty(); }
+    size_t Size() const { return m_host.size(); }
+    const Detector &Get(size_t d) const { return m_host[d]; }
+    Accum Bin(size_t d, int k, int t) const
+    {
+        return histogram(m_host[d].offset + k * m_host[d].numTimeBins + t);
+    }
+    // 第k个半径格在所有时间格上的和
+    Accum Bin(size_t d, int k) const
+    {
+        Accum sum = 0;
+        for (int t = 0; t < m_host[d].numTimeBins; t++) sum += Bin(d, k, t);
+        return sum;
+    }
+    // 第k格的中心半径
+    Scalar BinRadius(size_t d, int k) const
+    {
+        const Detector &det = m_host[d];
+        return det.numBins == 1 ? (det.rMin + (det.rMax < REALMAX ? det.rMax : det.rMin)) / 2
+                                : det.rMin + (det.rMax - det.rMin) * (k + (Scalar)0.5) / det.numBins;
+    }
+    // 第t个时间格的中心时间(pathlength为true时为路径长度)
+    Scalar BinTime(size_t d, int t) const
+    {
+        const Detector &det = m_host[d];
+        return det.numTimeBins == 1 ? (det.tMin + (det.tMax < REALMAX ? det.tMax : det.tMin)) / 2
+                                    : det.tMin + (det.tMax - det.tMin) * (t + (Scalar)0.5) / det.numTimeBins;
+    }
+    // 超过所有探测器的时间窗终点的光子不会再被计入, 可以直接终止; 有探测器不限制飞行时间时返回REALMAX
+    Scalar TimeGate() const
+    {
+        Scalar gate = 0;
+        for (const Detector &d : m_host)
+        {
+            if (d.pathlength || d.tMax >= REALMAX) return REALMAX;
+            gate = d.tMax > gate ? d.tMax : gate;
+        }
+        return m_host.empty() ? REALMAX : gate;
+    }
+    void Reset() { Kokkos::deep_copy(histogram, 0.0); }
+
+    // 值x在[lo, hi)上均匀划分为n格时的格号, 越界返回-1
+    KOKKOS_INLINE_FUNCTION
+    static int Bin(Scalar x, Scalar lo, Scalar hi, int n)
+    {
+        if (x < lo || x >= hi) return -1;
+        if (n == 1) return 0;
+        const int k = (int)((x - lo) / (hi - lo) * n);
+        return k < n ? k : n - 1;
+    }
+    // 结果中的dir为出射前网格内的方向, 按Snell定律折射到折射率为nOut的环境介质; 全反射时返回false
+    KOKKOS_INLINE_FUNCTION
+    static bool ExitDirection(const TetMesh &mesh, const resultType &r, Scalar nOut, Vec3f &out)
+    {
+        const Vec3f &nor    = mesh.FaceNormal(r.pyramidIndex, r.face);  // 单位外法向
+        const Scalar eta    = mesh.GetMaterial(r.pyramidIndex).n / nOut;
+        const Scalar cosIn  = r.dir.dot(nor);
+        const Scalar sin2Out = eta * eta * (1 - cosIn * cosIn);
+        if (sin2Out >= 1) return false;
+        out = r.dir * eta + nor * (Kokkos::sqrt(1 - sin2Out) - eta * cosIn);
+        return true;
+    }
+    // 返回光子被探测器det计入的格(相对offset), 不满足条件时返回-1
+    KOKKOS_INLINE_FUNCTION
+    static int Classify(const TetMesh &mesh, const Detector &det, const resultType &r)
+    {
+        // 只计入从边界面离开的光子, 按收集标签在网格内部判为OUTOFRANGE的光子没有出射面
+        if (r.pyramidIndex < 0 || r.face < 0) return -1;
+        if (det.bcnr >= 0)
+        {
+            const Index s = TetMesh::BoundarySurface(mesh.faceNeighbors(r.pyramidIndex)[r.face]);
+            if (s < 0 || mesh.surfaceElements(s).bcnr != det.bcnr) return -1;
+        }
+        // 接收角按折射到环境介质后的方向判断
+        const Scalar nOut = mesh.materials(0).n;
+        Vec3f out;
+        if (!ExitDirection(mesh, r, nOut, out)) return -1;
+        const Scalar sinMax = det.na / nOut;
+        const Scalar cosMax = sinMax >= 1 ? 0 : Kokkos::sqrt(1 - sinMax * sinMax);
+        const Scalar cosDir = det.normal.dot(out);
+        if (cosDir <= 0 || cosDir < cosMax) return -1;
+        const Vec3f rel    = r.pos - det.center;
+        const Vec3f radial = rel - det.normal * rel.dot(det.normal);
+        const int k        = Bin(radial.norm(), det.rMin, det.rMax, det.numBins);
+        if (k < 0) return -1;
+        const int t = Bin(det.pathlength ? r.Ps : r.time, det.tMin, det.tMax, det.numTimeBins);
+        return t < 0 ? -1 : k * det.numTimeBins + t;
+    }
+
+    // 计入直方图的权重, 缺省为光子的权重; 光谱模式下为各组的权重(见SetWeight)
+    typedef struct ResultWeight
+    {
+        KOKKOS_INLINE_FUNCTION
+        Accum operator()(const resultType &r) const { return r.weight; }
+    } ResultWeight;
+    // 数组归约: 每个线程一份长度为histogram.extent(0)的局部直方图, 最后合并
+    template <class ResultView, class Weight>
+    struct HistogramFunctor
+    {
+        using value_type = Accum[];
+        const unsigned value_count;
+        TetMesh mesh;
+        Kokkos::View<Detector *, ExecSpace> detectors;
+        ResultView results;
+        Weight weight;
+
+        KOKKOS_INLINE_FUNCTION
+        void operator()(const size_t i, value_type hist) const
+        {
+            const resultType &r = results(i);
+            if (r.type != CollectType::OUTOFRANGE) return;
+            const Accum w = weight(r);
+            for (size_t d = 0; d < detectors.extent(0); d++)
+            {
+                const int k = Classify(mesh, detectors(d), r);
+                if (k >= 0) hist[detectors(d).offset + k] += w;
+            }
+        }
+        KOKKOS_INLINE_FUNCTION
+        void init(value_type hist) const
+        {
+            for (unsigned k = 0; k < value_count; k++) hist[k] = 0;
+        }
+        KOKKOS_INLINE_FUNCTION
+        void join(value_type dst, const value_type src) const
+        {
+            for (unsigned k = 0; k < value_count; k++) dst[k] += src[k];
+        }
+    };
+
+    template <class ResultView, class Weight = ResultWeight>
+    void Accumulate(const TetMesh &mesh, const ResultView &results, const Weight &weight = Weight())
+    {
+        if (Empty() || results.extent(0) == 0) return;
+        Kokkos::View<Accum *, Kokkos::HostSpace> batch("detectorBatch", histogram.extent(0));
+        HistogramFunctor<ResultView, Weight> functor{(unsigned)histogram.extent(0), mesh, detectors, results, weight};
+        Kokkos::parallel_reduce("DetectorHistogram", Kokkos::RangePolicy<ExecSpace>(0, results.extent(0)), functor,
+                                batch);
+        for (size_t k = 0; k < histogram.extent(0); k++) histogram(k) += batch(k);
+    }
+
+   private:
+    std::vector<Detector> m_host;
+};
+#endif
@@ -0,0 +1,187 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+#include <mpi.h>
+#include <algorithm>
+#include <functional>
+#include <optional>
+#include <utility>
+#include <vector>
+#include "Run.h"
+
+// 多进程(MPI)分布式运行, 每个rank一个Run和一个Kokkos执行空间(如每个socket一个OpenMP进程, 或每块GPU一个进程)
+// - 光子按全局编号划分给各rank, 第i个光子的随机数流只由(种子, i)决定, 任意rank数下每个光子的路径都相同
+// - 每个节点的第一个rank先加载网格并写网格缓存, 其余rank再从缓存加载, 缓存文件经mmap在节点内共享页缓存
+// - 各统计在结束时或每个检查点用MPI_Reduce(实现中为树形归约)求和到rank 0
+// 所有rank必须以相同的参数调用同样的设置函数和run_batched
+
+// 归约到rank 0的全局统计, 只在rank 0上有效
+typedef struct DistributedTally
+{
+    uint64_t photons = 0;  // 已完成的全局光子数
+    RunTally run;
+    std::vector<Accum> detectors;  // 探测器直方图, 格与DetectorSet::histogram相同
+    std::vector<Accum> absorbed;   // 每个四面体的吸收权重, 未开启吸收统计时为空
+    // 光谱模式: 每组的出射权重, 探测器直方图按组依次排列, 吸收为(四面体, 组)
+    std::vector<Accum> spectralCollected, spectralOutOfRange, spectralDetectors, spectralAbsorbed;
+    TransportCounters counters;
+    double slowestSeconds = 0;  // 各rank传输时间的最大/最小值, 二者之比反映负载均衡
+    double fastestSeconds = 0;
+} DistributedTally;
+
+class DistributedRun
+{
+   public:
+    // 检查点回调, 只在rank 0上调用
+    using Checkpoint = std::function<void(const DistributedTally &)>;
+
+    DistributedRun(MPI_Comm comm, const char *mesh_path) : m_comm(comm)
+    {
+        MPI_Comm_rank(comm, &m_rank);
+        MPI_Comm_size(comm, &m_size);
+        MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, m_rank, MPI_INFO_NULL, &m_node);
+        int nodeRank = 0;
+        MPI_Comm_rank(m_node, &nodeRank);
+        if (nodeRank == 0) m_run.emplace(mesh_path);
+        MPI_Barrier(m_node);
+        if (nodeRank != 0) m_run.emplace(mesh_path);
+    }
+    ~DistributedRun() { MPI_Comm_free(&m_node); }
+    DistributedRun(const DistributedRun &)            = delete;
+    DistributedRun &operator=(const DistributedRun &) = delete;
+
+    int Rank() const { return m_rank; }
+    int Size() const { return m_size; }
+    // 本rank的Run, 用于设置材料、探测器、吸收统计等; 各rank的设置必须相同
+    Run &Local() { return *m_run; }
+    // 把[0, total)均分为Size()段, 返回第rank段的(起点, 个数), 前total % size段多一个
+    static std::pair<uint64_t, uint64_t> Partition(uint64_t total, int rank, int size)
+    {
+        const uint64_t base  = total / size;
+        const uint64_t extra = total % size;
+        const uint64_t first = rank * base + std::min<uint64_t>(rank, extra);
+        return {first, base + (rank < (int)extra ? 1 : 0)};
+    }
+
+    // 运行全局编号为[0, num_photons)的光子, source为Photon3D或Source. checkpoint > 0时每checkpoint个全局光子
+    // 归约一次并在rank 0上调用onCheckpoint; 每段内各rank取Partition给出的连续编号, 按batch_size分批传输.
+    // 返回全部完成后的全局统计(只在rank 0上有效)
+    template <class SourceT>
+    DistributedTally run_batched(uint64_t num_photons, size_t batch_size, uint64_t seed, Engine engine,
+                                 const SourceT &source, uint64_t checkpoint = 0,
+                                 const Checkpoint &onCheckpoint = nullptr)
+    {
+        if (checkpoint == 0) checkpoint = num_photons;
+        DistributedTally tally;
+        for (uint64_t start = 0; start < num_photons; start += checkpoint)
+        {
+            const uint64_t chunk      = std::min(checkpoint, num_photons - start);
+            const auto [first, count] = Partition(chunk, m_rank, m_size);
+            Kokkos::Timer timer;
+            m_run->SetSeed(seed, start + first);
+            if (count > 0)
+            {
+                m_local += m_run->run_batched(count, batch_size, nullptr, engine, source);
+                m_counters += m_run->LastCounters();
+            }
+            Kokkos::fence();
+            m_seconds += timer.seconds();
+            tally         = Reduce();
+            tally.photons = start + chunk;
+            if (m_rank == 0 && onCheckpoint && start + chunk < num_photons) onCheckpoint(tally);
+        }
+        return tally;
+    }
+    // 重放: 各rank对自己的缓冲重新加权后求和到rank 0
+    ReplayResult Reweight(const std::vector<Attribute> &byDomain) const
+    {
+        ReplayResult result = m_run->Replay().Reweight(byDomain);
+        Sum(result.signal);
+        Sum(result.dMua);
+        Sum(result.dMus);
+        return result;
+    }
+
+   private:
+    MPI_Comm m_comm;
+    MPI_Comm m_node;  // 同一节点(共享内存)上的rank
+    int m_rank = 0, m_size = 1;
+    std::optional<Run> m_run;
+    RunTally m_local;  // 本rank的累计计数
+    TransportCounters m_counters;
+    double m_seconds = 0;  // 本rank的累计传输时间
+
+    static MPI_Datatype AccumType() { return sizeof(Accum) == sizeof(float) ? MPI_FLOAT : MPI_DOUBLE; }
+    // 按元素求和到rank 0, 超过int范围的数组分段归约
+    template <class T>
+    void Sum(T *values, size_t n, MPI_Datatype type) const
+    {
+        constexpr size_t CHUNK = size_t(1) << 30;
+        for (size_t offset = 0; offset < n; offset += CHUNK)
+        {
+            const int count = (int)std::min(CHUNK, n - offset);
+            if (m_rank == 0)
+                MPI_Reduce(MPI_IN_PLACE, values + offset, count, type, MPI_SUM, 0, m_comm);
+            else
+                MPI_Reduce(values + offset, nullptr, count, type, MPI_SUM, 0, m_comm);
+        }
+    }
+    void Sum(std::vector<Accum> &values) const { Sum(values.data(), values.size(), AccumType()); }
+    template <class View>
+    std::vector<Accum> Host(const View &view) const
+    {
+        std::vector<Accum> values(view.size());
+        Kokkos::View<Accum *, Kokkos::HostSpace, Kokkos::MemoryTraits<Kokkos::Unmanaged>> values_h(values.data(),
+                                                                                                   values.size());
+        using Flat = Kokkos::View<const Accum *, typename View::memory_space, Kokkos::MemoryTraits<Kokkos::Unmanaged>>;
+        Kokkos::deep_copy(values_h, Flat(view.data(), view.size()));
+        return values;
+    }
+    DistributedTally Reduce()
+    {
+        Kokkos::Profiling::ScopedRegion region("DistributedRun::Reduce");
+        DistributedTally tally;
+        uint64_t counts[4] = {m_local.photons, m_local.collected, m_local.outOfRange, m_local.ignored};
+        Accum weights[2]   = {m_local.collectedWeight, m_local.outOfRangeWeight};
+        Sum(counts, 4, MPI_UINT64_T);
+        Sum(weights, 2, AccumType());
+        tally.run.photons          = counts[0];
+        tally.run.collected        = counts[1];
+        tally.run.outOfRange       = counts[2];
+        tally.run.ignored          = counts[3];
+        tally.run.collectedWeight  = weights[0];
+        tally.run.outOfRangeWeight = weights[1];
+        tally.counters             = m_counters;
+        Sum(tally.counters.values, (size_t)Counter::COUNT, MPI_UINT64_T);
+        MPI_Reduce(&m_seconds, &tally.slowestSeconds, 1, MPI_DOUBLE, MPI_MAX, 0, m_comm);
+        MPI_Reduce(&m_seconds, &tally.fastestSeconds, 1, MPI_DOUBLE, MPI_MIN, 0, m_comm);
+
+        const DetectorSet &detectors = m_run->Detectors();
+        tally.detectors.assign(detectors.histogram.data(), detectors.histogram.data() + detectors.histogram.size());
+        Sum(tally.detectors);
+        AbsorptionTally &absorption = m_run->Absorption();
+        if (absorption.Enabled())
+        {
+            absorption.Finalize();
+            tally.absorbed = Host(absorption.absorbed);
+            Sum(tally.absorbed);
+        }
+        const SpectralTally &spectral = m_run->Spectral();
+        tally.spectralCollected       = spectral.collectedWeight;
+        tally.spectralOutOfRange      = spectral.outOfRangeWeight;
+        for (const DetectorSet &set : spectral.detectors)
+        {
+            tally.spectralDetectors.insert(tally.spectralDetectors.end(), set.histogram.data(),
+                                           set.histogram.data() + set.histogram.size());
+        }
+        Sum(tally.spectralCollected);
+        Sum(tally.spectralOutOfRange);
+        Sum(tally.spectralDetectors);
+        if (m_run->PropertySets().absorbed.size() > 0)
+        {
+            tally.spectralAbsorbed = Host(m_run->PropertySets().absorbed);
+            Sum(tally.spectralAbsorbed);
+        }
+        return tally;
+    }
+};
+#endif
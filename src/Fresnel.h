@@ -0,0 +1,156 @@
+#ifndef FRESNEL_H
+#define FRESNEL_H
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "Material.h"
+
+// 界面反射率的计算方式, 每次运行可选
+enum class FresnelMode
+{
+    EXACT,  // 每次穿过折射率不同的界面都按Fresnel公式计算(acos/sin/tan)
+    TABLE   // 查表并线性插值
+};
+
+// 非偏振光的Fresnel反射率, ci/ct为入射角/折射角的余弦(均>=0), 用余弦形式避免三角函数, 只在host上建表时使用
+inline double FresnelReflectance(double ni, double nt, double ci, double ct)
+{
+    const double rs = (ni * ci - nt * ct) / (ni * ci + nt * ct);
+    const double rp = (ni * ct - nt * ci) / (ni * ct + nt * ci);
+    return 0.5 * (rs * rs + rp * rp);
+}
+
+// 网格中出现的每一对有序材料界面(ni, nt)一张反射率表, 网格和材料确定后一次建好.
+// 反射率以低折射率一侧的余弦c为自变量: ni > nt 时为折射角余弦, ni < nt 时为入射角余弦.
+// 以c为自变量时R(c)在[0, 1]上光滑(全反射临界角对应c = 0), 等距采样后线性插值的误差不超过 h²/8·max|R''|, h = 1/resolution;
+// 以入射角余弦为自变量时临界角处R有根号型奇点, 同样的分辨率误差要大几个数量级.
+// 每张表建好后在格点中间与精确值比较, 实测最大误差记在Interface::maxError中;
+// 组织常见的折射率(1.3~1.9)在resolution = 1024时约为1e-5, 分辨率加倍误差约减为1/4.
+// 折射角余弦总是用一次sqrt精确计算(全反射判断和折射方向都需要它), 表中只存反射率.
+class FresnelTable
+{
+   public:
+    static constexpr int DEFAULT_RESOLUTION = 1024;
+    typedef struct Interface
+    {
+        Scalar nipnt       = 1;      // ni / nt
+        Scalar nipnt2      = 1;      // (ni / nt)²
+        int offset         = 0;      // 在reflectance中的起始位置, 共resolution + 1个采样
+        bool byTransmitted = false;  // true: 以折射角余弦查表(ni > nt)
+        Scalar maxError    = 0;      // 实测的最大插值误差
+    } Interface;
+
+    // (当前材料, 下一个材料) -> interfaces中的编号, -1 表示两侧折射率相同, 直接穿过
+    Kokkos::View<int16_t *, ExecSpace> slots;
+    Kokkos::View<const Interface *, ExecSpace, Kokkos::MemoryTraits<Kokkos::RandomAccess>> interfaces;
+    Kokkos::View<const float *, ExecSpace, Kokkos::MemoryTraits<Kokkos::RandomAccess>> reflectance;
+    int resolution = DEFAULT_RESOLUTION;
+
+    FresnelTable() = default;
+    // used(a * MAX_MATERIALS + b)非0表示网格中有从材料a到材料b的界面; 折射率相同的材料对不建表,
+    // 折射率相同的不同材料对共用一张表
+    FresnelTable(const Kokkos::View<const int *, Kokkos::HostSpace> &used,
+                 const Kokkos::View<const Material *, Kokkos::HostSpace> &materials, int resolution_)
+        : resolution(resolution_)
+    {
+        if (resolution < 1) throw std::runtime_error("Fresnel表的分辨率必须为正数");
+        constexpr int M = MaterialTable::MAX_MATERIALS;
+        Kokkos::View<int16_t *, Kokkos::HostSpace> slots_h("fresnelSlots_h", M * M);
+        Kokkos::deep_copy(slots_h, (int16_t)-1);
+        std::map<std::pair<Scalar, Scalar>, int16_t> known;
+        std::vector<Interface> faces;
+        std::vector<float> samples;
+        for (int a = 0; a < M; a++)
+        {
+            for (int b = 0; b < M; b++)
+            {
+                const Scalar ni = materials(a).n, nt = materials(b).n;
+                if (!used(a * M + b) || ni == nt || IsNan(ni) || IsNan(nt)) continue;
+                auto found = known.find({ni, nt});
+                if (found == known.end())
+                {
+                    if (faces.size() >= 32767) throw std::runtime_error("Fresnel表过多");
+                    found = known.emplace(std::make_pair(ni, nt), (int16_t)faces.size()).first;
+                    faces.push_back(Tabulate(ni, nt, samples));
+                }
+                slots_h(a * M + b) = found->second;
+            }
+        }
+        slots = Kokkos::View<int16_t *, ExecSpace>("fresnelSlots", M * M);
+        Kokkos::deep_copy(slots, slots_h);
+        m_host = Kokkos::View<Interface *, Kokkos::HostSpace>("fresnelInterfaces_h", faces.size());
+        std::copy(faces.begin(), faces.end(), m_host.data());
+        Kokkos::View<Interface *, ExecSpace> interfaces_d("fresnelInterfaces", faces.size());
+        Kokkos::deep_copy(interfaces_d, m_host);
+        Kokkos::View<float *, ExecSpace> reflectance_d("fresnelReflectance", samples.size());
+        Kokkos::deep_copy(reflectance_d, Kokkos::View<float *, Kokkos::HostSpace,
+                                                      Kokkos::MemoryTraits<Kokkos::Unmanaged>>(samples.data(),
+                                                                                               samples.size()));
+        interfaces  = interfaces_d;
+        reflectance = reflectance_d;
+    }
+
+    size_t NumInterfaces() const { return m_host.extent(0); }
+    // 所有表的实测最大插值误差
+    Scalar MaxError() const
+    {
+        Scalar error = 0;
+        for (size_t k = 0; k < m_host.extent(0); k++) error = std::max(error, m_host(k).maxError);
+        return error;
+    }
+
+    KOKKOS_INLINE_FUNCTION
+    int Slot(uint8_t from, uint8_t to) const { return slots((int)from * MaterialTable::MAX_MATERIALS + to); }
+    // costhi, costht为入射角/折射角余弦的绝对值
+    KOKKOS_INLINE_FUNCTION
+    Scalar Reflectance(const Interface &face, Scalar costhi, Scalar costht) const
+    {
+        const Scalar u = (face.byTransmitted ? costht : costhi) * resolution;
+        int k          = (int)u;
+        k              = k < resolution ? k : resolution - 1;
+        const Scalar r0 = reflectance(face.offset + k);
+        const Scalar r1 = reflectance(face.offset + k + 1);
+        return r0 + (u - k) * (r1 - r0);
+    }
+
+   private:
+    // host上的副本, 只用于报告误差; TetMesh会被拷进kernel, 这里不能用std::vector
+    Kokkos::View<Interface *, Kokkos::HostSpace> m_host;
+
+    Interface Tabulate(Scalar ni_, Scalar nt_, std::vector<float> &samples) const
+    {
+        const double ni = ni_, nt = nt_;
+        Interface face;
+        face.nipnt         = (Scalar)(ni / nt);
+        face.nipnt2        = face.nipnt * face.nipnt;
+        face.offset        = (int)samples.size();
+        face.byTransmitted = ni > nt;
+        // 低折射率一侧的余弦c对应的反射率
+        auto exact = [&](double c)
+        {
+            if (face.byTransmitted)
+            {
+                const double ci = std::sqrt(1 - (1 - c * c) * (nt / ni) * (nt / ni));
+                return FresnelReflectance(ni, nt, ci, c);
+            }
+            const double ct = std::sqrt(1 - (1 - c * c) * (ni / nt) * (ni / nt));
+            return FresnelReflectance(ni, nt, c, ct);
+        };
+        for (int k = 0; k <= resolution; k++) samples.push_back((float)exact((double)k / resolution));
+        double error = 0;
+        for (int k = 0; k < resolution; k++)
+        {
+            for (double f : {0.25, 0.5, 0.75})
+            {
+                const double r0 = samples[face.offset + k], r1 = samples[face.offset + k + 1];
+                error = std::max(error, std::fabs(r0 + (r1 - r0) * f - exact((k + f) / resolution)));
+            }
+        }
+        face.maxError = (Scalar)error;
+        return face;
+    }
+};
+#endif
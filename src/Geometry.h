@@ -16,55 +16,69 @@ class Face
     bool operator==(const Face &f) const { return p1 == f.p1 && p2 == f.p2 && p3 == f.p3; }
 };
 
+// 四面体第f个面(0..3)的第k个顶点(0..2)在四面体内的局部编号
+// 面顺序: f0=(0,1,2) f1=(0,1,3) f2=(0,2,3) f3=(1,2,3), 第f个面正对局部顶点 3-f
+KOKKOS_INLINE_FUNCTION
+int TetFaceVertex(int f, int k) { return (int)((0x321320310210ULL >> (4 * (3 * f + k))) & 0xF); }
+KOKKOS_INLINE_FUNCTION
+int TetFaceOpposite(int f) { return 3 - f; }
+
+// 四面体的光学属性, 与顶点数据分开按四面体存放
+typedef struct Attribute
+{
+    Scalar mua = NANVALUE, mus = NANVALUE, g = NANVALUE, n = NANVALUE;
+} Attribute;
+
+// 四面体4个面的外法向平面: 点p在面f外侧当且仅当 normal[f].dot(p) > d[f]
+typedef struct TetFaces
+{
+    Vec3f normal[4];
+    Scalar d[4] = {0, 0, 0, 0};
+    KOKKOS_INLINE_FUNCTION
+    Scalar Distance(int f, const Point &p) const { return normal[f].dot(p) - d[f]; }
+} TetFaces;
+
+// 从共享顶点数组中按索引取出的四面体, 只在需要坐标时临时构造, 不作为网格的存储格式
 class Pyramid
 {
    public:
     Point p1, p2, p3, p4;
-    Face f1, f2, f3, f4;
-    typedef struct _value
-    {
-        Scalar mua = NANVALUE, mus = NANVALUE, g = NANVALUE, n = NANVALUE;
-    } Attribute;
-    Attribute value;
     KOKKOS_INLINE_FUNCTION
-    Pyramid(Point p1, Point p2, Point p3, Point p4)
-        : p1(p1),
-          p2(p2),
-          p3(p3),
-          p4(p4),
-          f1(p1, p2, p3),
-          f2(p1, p2, p4),
-          f3(p1, p3, p4),
-          f4(p2, p3, p4)
+    Pyramid(Point p1, Point p2, Point p3, Point p4) : p1(p1), p2(p2), p3(p3), p4(p4) {}
+    KOKKOS_INLINE_FUNCTION
+    Pyramid() : p1(), p2(), p3(), p4() {}
+    KOKKOS_INLINE_FUNCTION
+    const Point &vertex(int k) const { return k == 0 ? p1 : (k == 1 ? p2 : (k == 2 ? p3 : p4)); }
+    KOKKOS_INLINE_FUNCTION
+    Face face(int f) const
     {
+        return Face(vertex(TetFaceVertex(f, 0)), vertex(TetFaceVertex(f, 1)), vertex(TetFaceVertex(f, 2)));
     }
     KOKKOS_INLINE_FUNCTION
-    Pyramid() : p1(), p2(), p3(), p4(), 
-                f1(), f2(), f3(), f4(),
-                value() {}
-    KOKKOS_INLINE_FUNCTION
     bool operator==(const Pyramid &p) const
     {
         return p1 == p.p1 && p2 == p.p2 && p3 == p.p3 && p4 == p.p4;
     }
+    // 计算4个面的外法向平面
     KOKKOS_INLINE_FUNCTION
-    bool HasFace(const Face &f) const { return f1 == f || f2 == f || f3 == f || f4 == f; }
-    KOKKOS_INLINE_FUNCTION
-    bool HasFace(const Point &p1, const Point &p2, const Point &p3) const
+    TetFaces Planes() const
     {
-        return f1 == Face(p1, p2, p3) || f2 == Face(p1, p2, p3) || f3 == Face(p1, p2, p3) ||
-               f4 == Face(p1, p2, p3);
-    }
-    KOKKOS_INLINE_FUNCTION
-    bool isOnSameSide(const Point &p, const Face &face) const {
-        Point normal = face.normal();
-        Scalar d = -(normal.dot(face.p1));
-        Scalar distance = normal.dot(p) + d;
-        return distance >= 0; // Assuming the normal points outwards from the pyramid
-    }
-    KOKKOS_INLINE_FUNCTION
-    bool InPyramid(const Point &p) const {
-        return isOnSameSide(p, f1) && isOnSameSide(p, f2) && isOnSameSide(p, f3) && isOnSameSide(p, f4);
+        TetFaces planes;
+        for (int f = 0; f < 4; f++)
+        {
+            const Point &a   = vertex(TetFaceVertex(f, 0));
+            const Point &b   = vertex(TetFaceVertex(f, 1));
+            const Point &c   = vertex(TetFaceVertex(f, 2));
+            const Point &opp = vertex(TetFaceOpposite(f));
+            Vec3f normal     = (b - a).cross(c - a).normalize();
+            if (normal.dot(opp - a) > 0)
+            {
+                normal = normal * -1;
+            }
+            planes.normal[f] = normal;
+            planes.d[f]      = normal.dot(a);
+        }
+        return planes;
     }
 };
 class IntersectionUtils
@@ -184,12 +198,10 @@ class IntersectionUtils
                                                                         const Point &dir)
     {
         IntersectionResult4 results;
-
-        results.result[0] = ray_triangle_intersection(pyramid.f1, orig, dir);
-        results.result[1] = ray_triangle_intersection(pyramid.f2, orig, dir);
-        results.result[2] = ray_triangle_intersection(pyramid.f3, orig, dir);
-        results.result[3] = ray_triangle_intersection(pyramid.f4, orig, dir);
-
+        for (int f = 0; f < 4; f++)
+        {
+            results.result[f] = ray_triangle_intersection(pyramid.face(f), orig, dir);
+        }
         return results;
     }
 };
@@ -0,0 +1,89 @@
+#ifndef MATERIAL_H
+#define MATERIAL_H
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "Geometry.h"
+
+// 材料表中的一项: 光学属性及传输内循环用到的导出量, 加载时计算一次, 传输中不再做除法
+typedef struct Material
+{
+    Scalar mua = NANVALUE, mus = NANVALUE, g = NANVALUE, n = NANVALUE;
+    Scalar mut      = 0;  // mua + mus
+    Scalar invMut   = 0;  // 1 / mut, mut为0时为0
+    Scalar invMus   = 0;  // 1 / mus, mus为0时为0; 光谱模式只按μs抽样自由程
+    Scalar albedo   = 0;  // mus / mut, 每次作用保留的权重比例
+    Scalar g2       = 0;  // g * g
+    Scalar invSpeed = 0;  // n / c, 单位长度(mm)的飞行时间(ns)
+    // HG相函数的反函数写成有理形式 cosθ = hgA - hgB / (hgC + hgD·ξ)², g = 0 时不使用
+    Scalar hgA = 0, hgB = 0, hgC = 0, hgD = 0;
+    Material() = default;
+    explicit Material(const Attribute &a) : mua(a.mua), mus(a.mus), g(a.g), n(a.n)
+    {
+        mut      = mua + mus;
+        invMut   = mut > 0 ? 1 / mut : 0;
+        invMus   = mus > 0 ? 1 / mus : 0;
+        albedo   = mut > 0 ? mus / mut : 0;
+        g2       = g * g;
+        invSpeed = n / LIGHT_SPEED;
+        if (g != 0)
+        {
+            hgA = (1 + g2) / (2 * g);
+            hgB = (1 - g2) * (1 - g2) / (2 * g);
+            hgC = 1 - g;
+            hgD = 2 * g;
+        }
+    }
+    KOKKOS_INLINE_FUNCTION
+    bool Valid() const { return !IsNan(mua) && !IsNan(mus) && !IsNan(g) && !IsNan(n); }
+} Material;
+
+// 材料侧文件: 与网格同名, 扩展名为.mat, 按NETGEN域编号(volumeelements的matnr)给出光学属性
+//   # domain  mua   mus   g     n
+//   0         0     0     0     1.0     <- 域0为网格外的环境介质, 缺省时取真空(n = 1)
+//   1         0.1   10    0.9   1.37
+// 长度单位为mm, 系数单位为1/mm
+class MaterialTable
+{
+   public:
+    static constexpr int MAX_MATERIALS = 256;  // 四面体的材料编号为uint8_t
+
+    // 环境介质的缺省值
+    static Attribute Ambient() { return Attribute{0, 0, 0, 1}; }
+    static std::string PathFor(const std::string &meshPath)
+    {
+        const size_t dot   = meshPath.find_last_of('.');
+        const size_t slash = meshPath.find_last_of('/');
+        if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) return meshPath + ".mat";
+        return meshPath.substr(0, dot) + ".mat";
+    }
+    // 返回按域编号索引的属性, 文件中没有出现的域保持未设置(NANVALUE)
+    static std::vector<Attribute> Load(const std::string &path)
+    {
+        std::ifstream file(path);
+        if (!file) throw std::runtime_error("无法打开材料文件: " + path);
+        std::vector<Attribute> byDomain(MAX_MATERIALS);
+        byDomain[0] = Ambient();
+        std::string line;
+        int lineNumber = 0;
+        while (std::getline(file, line))
+        {
+            lineNumber++;
+            const size_t comment = line.find('#');
+            if (comment != std::string::npos) line.erase(comment);
+            std::istringstream fields(line);
+            int domain;
+            Attribute a;
+            if (!(fields >> domain)) continue;
+            if (!(fields >> a.mua >> a.mus >> a.g >> a.n) || domain < 0 || domain >= MAX_MATERIALS)
+            {
+                throw std::runtime_error(path + " 第" + std::to_string(lineNumber) + "行无法解析");
+            }
+            byDomain[domain] = a;
+        }
+        return byDomain;
+    }
+};
+#endif
@@ -1,13 +1,29 @@
 #ifndef MESH_H
 #define MESH_H
 #include <Kokkos_Core.hpp>
+#include <Kokkos_Profiling_ScopedRegion.hpp>
 #include <Kokkos_UnorderedMap.hpp>
 #include <fstream>
+#include <algorithm>
+#include <vector>
 #include "Utils.h"
 #include "Geometry.h"
-#define MAX_NEIGHBOR_COUNT_3  32
-#define MAX_NEIGHBOR_COUNT_2  128
-#define MAX_NEIGHBOR_COUNT_1  512
+#include "Fresnel.h"
+#include "Material.h"
+#include "MeshCache.h"
+#include "NetgenReader.h"
+#include "SpatialIndex.h"
+// 压缩行存储(CSR)的邻接表: 第i个四面体的邻居为 indices[offsets(i), offsets(i+1))
+typedef struct Adjacency
+{
+    Kokkos::View<size_t *, ExecSpace> offsets;
+    Kokkos::View<Index *, ExecSpace> indices;
+    KOKKOS_INLINE_FUNCTION
+    Index Count(Index i) const { return (Index)(offsets(i + 1) - offsets(i)); }
+    KOKKOS_INLINE_FUNCTION
+    Index operator()(Index i, Index k) const { return indices(offsets(i) + k); }
+    size_t Bytes() const { return offsets.extent(0) * sizeof(size_t) + indices.extent(0) * sizeof(Index); }
+} Adjacency;
 class TetMesh
 {
    private:
@@ -19,13 +35,28 @@ class TetMesh
    ~TetMesh(){
 
    }
-    Kokkos::View<Pyramid *, ExecSpace> pyramids;
-    Kokkos::View<int*, ExecSpace> adjacentPyramidsNum_1;
-    Kokkos::View<int*, ExecSpace> adjacentPyramidsNum_2;
-    Kokkos::View<int*, ExecSpace> adjacentPyramidsNum_3;
-    Kokkos::View<int*[MAX_NEIGHBOR_COUNT_1], ExecSpace> adjacentPyramids_1;
-    Kokkos::View<int*[MAX_NEIGHBOR_COUNT_2], ExecSpace> adjacentPyramids_2;
-    Kokkos::View<int*[MAX_NEIGHBOR_COUNT_3], ExecSpace> adjacentPyramids_3;
+    // 共享顶点的结构体数组(SoA)布局: 顶点只存一份, 四面体通过索引引用
+    Kokkos::View<Point *, ExecSpace> vertices;
+    Kokkos::View<Index4 *, ExecSpace> tetVertices;
+    Kokkos::View<TetFaces *, ExecSpace> tetFaces;
+    // 四面体第f个面对面的四面体; 负数表示该面在网格边界上, 值为BoundaryCode(s), s为对应的表面单元
+    Kokkos::View<Index4 *, ExecSpace> faceNeighbors;
+    // 四面体的材料编号, 即NETGEN volumeelements的域编号(matnr), 每个四面体一个字节
+    Kokkos::View<uint8_t *, ExecSpace> tetMaterials;
+    // 按材料编号索引的材料表, 只有几KB, 只读随机访问(CUDA上走只读缓存); 编号0为网格外的环境介质
+    Kokkos::View<const Material *, ExecSpace, Kokkos::MemoryTraits<Kokkos::RandomAccess>> materials;
+    // 网格中每对折射率不同的相邻材料的反射率表, 随材料表一起重建
+    FresnelTable fresnel;
+    // NETGEN surfaceelements: 边界及域间界面三角形, 带bcnr/domin/domout
+    Kokkos::View<SurfaceElement *, ExecSpace> surfaceElements;
+    Kokkos::View<FaceDescriptor *, Kokkos::HostSpace> faceDescriptors;
+    // 共享1个顶点/1条棱/1个面的邻居
+    Adjacency adjacentPyramids_1;
+    Adjacency adjacentPyramids_2;
+    Adjacency adjacentPyramids_3;
+    // 空间索引: tetTree的图元为四面体, boundaryTree的图元为边界面(编码为 4 * tet + face)
+    BVH tetTree;
+    BVH boundaryTree;
     static Scalar Distance(const Point &a, const Point &b)
     {
         Scalar dx = a.x - b.x;
@@ -34,11 +65,142 @@ class TetMesh
         return std::sqrt(dx * dx + dy * dy + dz * dz);
     }
     KOKKOS_FUNCTION
-    Scalar GetMinLength() const { return hasMinLength ? minLength : 1e6 * REALEPS; }
+    Scalar GetMinLength() const { return hasMinLength ? minLength : REALEPS; }
+    KOKKOS_INLINE_FUNCTION
+    Index NumTets() const { return (Index)tetVertices.extent(0); }
+    KOKKOS_INLINE_FUNCTION
+    const Point &Vertex(Index tet, int k) const { return vertices(tetVertices(tet)[k]); }
+    KOKKOS_INLINE_FUNCTION
+    Pyramid GetPyramid(Index tet) const
+    {
+        const Index4 v = tetVertices(tet);
+        return Pyramid(vertices(v[0]), vertices(v[1]), vertices(v[2]), vertices(v[3]));
+    }
+    KOKKOS_INLINE_FUNCTION
+    const Material &GetMaterial(Index tet) const { return materials(tetMaterials(tet)); }
+    // 按材料编号设置光学属性, byDomain[0]为环境介质; 没有给出的编号保持未设置
+    void SetMaterials(const std::vector<Attribute> &byDomain)
+    {
+        if (byDomain.size() > (size_t)MaterialTable::MAX_MATERIALS) throw std::runtime_error("材料编号超过255");
+        Kokkos::View<Material *, ExecSpace> table("materials", MaterialTable::MAX_MATERIALS);
+        auto table_h = Kokkos::create_mirror_view(table);
+        table_h(0)   = Material(MaterialTable::Ambient());
+        for (size_t d = 0; d < byDomain.size(); d++) table_h(d) = Material(byDomain[d]);
+        Kokkos::deep_copy(table, table_h);
+        materials = table;
+        BuildFresnelTable(fresnel.resolution);
+    }
+    // 找出网格中相邻的有序材料对(a, b)(外边界为(a, 0)), 为折射率不同的材料对建反射率表
+    void BuildFresnelTable(int resolution = FresnelTable::DEFAULT_RESOLUTION)
+    {
+        constexpr int M = MaterialTable::MAX_MATERIALS;
+        Kokkos::View<int *, ExecSpace> used("fresnelUsed", M * M);
+        auto tetMaterials_  = tetMaterials;
+        auto faceNeighbors_ = faceNeighbors;
+        Kokkos::parallel_for(
+            "FindInterfaces", Kokkos::RangePolicy<ExecSpace>(0, NumTets()), KOKKOS_LAMBDA(const Index i)
+            {
+                for (int f = 0; f < 4; f++)
+                {
+                    // 网格外边界的另一侧为环境介质(材料0)
+                    const Index j     = faceNeighbors_(i)[f];
+                    const int outside = j >= 0 ? tetMaterials_(j) : 0;
+                    if (outside != tetMaterials_(i)) used(tetMaterials_(i) * M + outside) = 1;
+                }
+            });
+        auto used_h      = Kokkos::create_mirror_view_and_copy(Kokkos::HostSpace(), used);
+        auto materials_h = Kokkos::create_mirror_view_and_copy(Kokkos::HostSpace(), materials);
+        fresnel          = FresnelTable(used_h, materials_h, resolution);
+    }
+    // 所有域使用同一种材料
+    void SetUniformMaterial(const Attribute &attr)
+    {
+        std::vector<Attribute> byDomain(MaterialTable::MAX_MATERIALS, attr);
+        byDomain[0] = MaterialTable::Ambient();
+        SetMaterials(byDomain);
+    }
+    void LoadMaterials(const std::string &path) { SetMaterials(MaterialTable::Load(path)); }
+    // 边界面在faceNeighbors中的编码: -1 表示没有对应的表面单元, -2-s 表示第s个表面单元
+    KOKKOS_INLINE_FUNCTION
+    static Index BoundaryCode(Index surface) { return -2 - surface; }
+    KOKKOS_INLINE_FUNCTION
+    static Index BoundarySurface(Index neighbor) { return neighbor <= -2 ? -2 - neighbor : -1; }
+    // 四面体体积, 四面体已按正朝向存储
+    KOKKOS_INLINE_FUNCTION
+    Scalar Volume(Index tet) const
+    {
+        const Index4 v = tetVertices(tet);
+        const Point a  = vertices(v[0]);
+        return (Scalar)((vertices(v[1]) - a).dot((vertices(v[2]) - a).cross(vertices(v[3]) - a)) / 6);
+    }
+    // 四面体tet第f个面的单位外法向
+    KOKKOS_INLINE_FUNCTION
+    const Vec3f &FaceNormal(Index tet, int f) const { return tetFaces(tet).normal[f]; }
+    // tolerance > 0 时允许p在面外侧tolerance以内, 用于落在面上的点(如射入网格的入射点)
+    KOKKOS_INLINE_FUNCTION
+    bool InPyramid(Index tet, const Point &p, Scalar tolerance = 0) const
+    {
+        const TetFaces &faces = tetFaces(tet);
+        return faces.Distance(0, p) <= tolerance && faces.Distance(1, p) <= tolerance &&
+               faces.Distance(2, p) <= tolerance && faces.Distance(3, p) <= tolerance;
+    }
+    // 按全局顶点索引判断四面体是否含有面(a, b, c), 不依赖浮点比较
+    KOKKOS_INLINE_FUNCTION
+    bool HasFace(Index tet, Index a, Index b, Index c) const
+    {
+        const Index4 v = tetVertices(tet);
+        auto has       = [&v](Index x) { return v[0] == x || v[1] == x || v[2] == x || v[3] == x; };
+        return has(a) && has(b) && has(c);
+    }
+    // 点定位: 返回包含p的四面体, p不在网格内时返回-1
+    KOKKOS_INLINE_FUNCTION
+    Index LocateTet(const Point &p) const
+    {
+        Index found = -1;
+        tetTree.QueryPoint(p,
+                           [&](Index tet)
+                           {
+                               if (!InPyramid(tet, p)) return false;
+                               found = tet;
+                               return true;
+                           });
+        return found;
+    }
+    // 网格外的射线与边界的第一个交点: 返回射线进入的四面体, *t为交点距离; 不相交时返回-1
+    KOKKOS_INLINE_FUNCTION
+    Index FirstBoundaryHit(const Point &orig, const Vec3f &dir, Scalar *t) const
+    {
+        Index found = -1;
+        Scalar tMax = REALMAX;
+        boundaryTree.QueryRay(orig, dir, tMax,
+                              [&](Index item, Scalar &tBest)
+                              {
+                                  const Index tet = item / 4;
+                                  const int f     = item % 4;
+                                  const Index4 v  = tetVertices(tet);
+                                  auto hit        = IntersectionUtils::ray_triangle_intersection(
+                                      vertices(v[TetFaceVertex(f, 0)]), vertices(v[TetFaceVertex(f, 1)]),
+                                      vertices(v[TetFaceVertex(f, 2)]), orig, dir);
+                                  if (hit.hit && hit.t < tBest)
+                                  {
+                                      tBest = hit.t;
+                                      found = tet;
+                                  }
+                              });
+        *t = tMax;
+        return found;
+    }
+    // 网格在设备上占用的字节数(不含邻接表)
+    size_t GeometryBytes() const
+    {
+        return vertices.extent(0) * sizeof(Point) +
+               tetVertices.extent(0) * (sizeof(Index4) + sizeof(uint8_t) + sizeof(TetFaces));
+    }
 
     void requireMinLength()
     {
-        auto policy = Kokkos::RangePolicy<>(0, pyramids.extent(0));
+        Kokkos::Profiling::ScopedRegion region("TetMesh::requireMinLength");
+        auto policy = Kokkos::RangePolicy<ExecSpace>(0, NumTets());
         Kokkos::parallel_reduce(
             "ComputeMinLength", policy,
             KOKKOS_CLASS_LAMBDA(const int i, Scalar &localMinLength)
@@ -48,15 +210,16 @@ class TetMesh
                     Scalar dx = a.x - b.x;
                     Scalar dy = a.y - b.y;
                     Scalar dz = a.z - b.z;
-                    return std::sqrt(dx * dx + dy * dy + dz * dz);
+                    return Kokkos::sqrt(dx * dx + dy * dy + dz * dz);
                 };
+                const Pyramid pyramid = GetPyramid(i);
                 Scalar lengths[6];
-                lengths[0] = Distance(pyramids(i).p1, pyramids(i).p2);
-                lengths[1] = Distance(pyramids(i).p1, pyramids(i).p3);
-                lengths[2] = Distance(pyramids(i).p1, pyramids(i).p4);
-                lengths[3] = Distance(pyramids(i).p2, pyramids(i).p3);
-                lengths[4] = Distance(pyramids(i).p2, pyramids(i).p4);
-                lengths[5] = Distance(pyramids(i).p3, pyramids(i).p4);
+                lengths[0] = Distance(pyramid.p1, pyramid.p2);
+                lengths[1] = Distance(pyramid.p1, pyramid.p3);
+                lengths[2] = Distance(pyramid.p1, pyramid.p4);
+                lengths[3] = Distance(pyramid.p2, pyramid.p3);
+                lengths[4] = Distance(pyramid.p2, pyramid.p4);
+                lengths[5] = Distance(pyramid.p3, pyramid.p4);
                 for (int j = 0; j < 6; ++j)
                 {
                     if (lengths[j] < localMinLength)
@@ -70,158 +233,443 @@ class TetMesh
     }
     void load_from_file(const std::string &filename)
     {
-        std::ifstream file(filename);
-        if (!file.is_open())
-        {
-            throw std::runtime_error("无法打开文件: " + filename);
-        }
+        Kokkos::Profiling::ScopedRegion region("TetMesh::load_from_file");
+        load_from_memory(NetgenReader::Read(filename), filename);
+    }
+    // 由已读入(或合成)的网格建立设备上的顶点、四面体和表面单元, name只用于错误信息
+    void load_from_memory(NetgenReader::Result mesh, const std::string &name)
+    {
+        const Index numTets       = (Index)mesh.tets.size();
+        const Index numPoints     = (Index)mesh.points.size();
+        Kokkos::View<Index4 *, Kokkos::HostSpace, Kokkos::MemoryTraits<Kokkos::Unmanaged>> tetVertices_host(
+            mesh.tets.data(), numTets);
+        Kokkos::View<Point *, Kokkos::HostSpace, Kokkos::MemoryTraits<Kokkos::Unmanaged>> points_host(
+            mesh.points.data(), numPoints);
+
+        // 统一四面体朝向, 使 (p2-p1)·((p3-p1)x(p4-p1)) > 0, 走行时的面/棱符号表依赖于此
+        Kokkos::parallel_for(
+            "OrientTets", Kokkos::RangePolicy<Kokkos::DefaultHostExecutionSpace>(0, numTets),
+            [&](const int i)
+            {
+                Index4 &v     = tetVertices_host(i);
+                const Point a = points_host(v[0]);
+                Scalar det = (points_host(v[1]) - a).dot((points_host(v[2]) - a).cross(points_host(v[3]) - a));
+                if (det < 0)
+                {
+                    Index tmp = v[2];
+                    v[2]      = v[3];
+                    v[3]      = tmp;
+                }
+            });
 
-        std::string line;
-        int numPoints, numTets;
-        // 读取四面体数量
-        while (std::getline(file, line))
+        // 将数据从host拷贝到device
+        vertices      = Kokkos::View<Point *, ExecSpace>("vertices", numPoints);
+        tetVertices   = Kokkos::View<Index4 *, ExecSpace>("tetVertices", numTets);
+        tetMaterials  = Kokkos::View<uint8_t *, ExecSpace>("tetMaterials", numTets);
+        Kokkos::deep_copy(vertices, points_host);
+        Kokkos::deep_copy(tetVertices, tetVertices_host);
+        auto tetMaterials_h = Kokkos::create_mirror_view(tetMaterials);
+        for (Index i = 0; i < numTets; i++)
         {
-            if (line.find("volumeelements") != std::string::npos)
+            const int domain = mesh.tetDomains[i];
+            if (domain < 1 || domain >= MaterialTable::MAX_MATERIALS)
             {
-                file >> numTets;
-                break;
+                throw std::runtime_error(name + ": 域编号" + std::to_string(domain) + "超出范围[1, 255]");
             }
+            tetMaterials_h(i) = (uint8_t)domain;
         }
-        std::vector<std::array<int, 4>> points_indices_host(numTets);
-        // 读取四面体顶点索引
-        for (int i = 0; i < numTets; i++)
-        {
-            int type, material, p1, p2, p3, p4;
-            file >> type >> material >> p1 >> p2 >> p3 >> p4;
-            // NETGEN的索引从1开始,需要减1
-            points_indices_host[i] = {p1 - 1, p2 - 1, p3 - 1, p4 - 1};
-        }
+        Kokkos::deep_copy(tetMaterials, tetMaterials_h);
+        surfaceElements = Kokkos::View<SurfaceElement *, ExecSpace>("surfaceElements", mesh.surfaces.size());
+        Kokkos::deep_copy(surfaceElements,
+                          Kokkos::View<SurfaceElement *, Kokkos::HostSpace, Kokkos::MemoryTraits<Kokkos::Unmanaged>>(
+                              mesh.surfaces.data(), mesh.surfaces.size()));
+        faceDescriptors =
+            Kokkos::View<FaceDescriptor *, Kokkos::HostSpace>("faceDescriptors", mesh.faceDescriptors.size());
+        std::copy(mesh.faceDescriptors.begin(), mesh.faceDescriptors.end(), faceDescriptors.data());
+        computeFaces();
+        hasMinLength = false;
+    }
+    void computeFaces()
+    {
+        tetFaces = Kokkos::View<TetFaces *, ExecSpace>("tetFaces", NumTets());
+        Kokkos::parallel_for(
+            "ComputeFaces", Kokkos::RangePolicy<ExecSpace>(0, NumTets()),
+            KOKKOS_CLASS_LAMBDA(const int i) { tetFaces(i) = GetPyramid(i).Planes(); });
+    }
+    // 用NETGEN顶点索引建立邻接关系, 复杂度O(N log N):
+    // 面邻接来自排序后的面键(顶点索引三元组), 点/边邻接来自顶点-四面体关联表
+    void buildNeighbors()
+    {
+        Kokkos::Profiling::ScopedRegion region("TetMesh::buildNeighbors");
+        using HostExec   = Kokkos::DefaultHostExecutionSpace;
+        const Index nTet = NumTets();
+        const Index nVtx = (Index)vertices.extent(0);
+        auto tets        = Kokkos::create_mirror_view_and_copy(Kokkos::HostSpace(), tetVertices);
 
-        // 读取点数量
-        while (std::getline(file, line))
+        // 顶点 -> 四面体 关联表(CSR), 按四面体编号升序填充
+        std::vector<Index> vtxOffsets(nVtx + 1, 0);
+        for (Index i = 0; i < nTet; i++)
         {
-            if (line.find("points") != std::string::npos)
+            for (int k = 0; k < 4; k++) vtxOffsets[tets(i)[k] + 1]++;
+        }
+        for (Index v = 0; v < nVtx; v++) vtxOffsets[v + 1] += vtxOffsets[v];
+        std::vector<Index> vtxTets(vtxOffsets[nVtx]);
+        {
+            std::vector<Index> cursor(vtxOffsets.begin(), vtxOffsets.end() - 1);
+            for (Index i = 0; i < nTet; i++)
             {
-                file >> numPoints;
-                break;
+                for (int k = 0; k < 4; k++) vtxTets[cursor[tets(i)[k]]++] = i;
             }
         }
 
-        // 分配点数组空间
-        auto points_host = Kokkos::View<Point *, Kokkos::HostSpace>("points", numPoints);
-
-        // 读取点坐标
-        for (int i = 0; i < numPoints; i++)
+        // 面邻接: 每个面以排序后的顶点索引为键, 排序后键相同的相邻两项即共面的四面体
+        struct FaceKey
         {
-            Scalar x, y, z;
-            file >> x >> y >> z;
-            points_host(i) = Point{x, y, z};
-        }
-        
-
-        // 分配四面体数组空间
-        auto pyramids_host = Kokkos::View<Pyramid *, Kokkos::HostSpace>("pyramidsHost", numTets);
-        for (int i = 0; i < numTets; i++)
-        {
-            int p1 = points_indices_host[i][0];
-            int p2 = points_indices_host[i][1];
-            int p3 = points_indices_host[i][2];
-            int p4 = points_indices_host[i][3];
-            // NETGEN的索引从1开始,需要减1
-            pyramids_host(i) = {points_host(p1), points_host(p2), points_host(p3), points_host(p4)};
-        }
-        
-        // 将数据从host拷贝到device
-        pyramids = Kokkos::create_mirror_view_and_copy(ExecSpace(), pyramids_host);
-        file.close();
-        hasMinLength = false;
-    }
-    void buildNeighbors()
-    {
-        auto rangePolicy = Kokkos::MDRangePolicy<Kokkos::Rank<2>>({0, 0}, {pyramids.extent(0), pyramids.extent(0)});
+            Index a, b, c, tet;
+            int face;
+            bool operator<(const FaceKey &o) const
+            {
+                return a != o.a ? a < o.a : (b != o.b ? b < o.b : (c != o.c ? c < o.c : tet < o.tet));
+            }
+            bool SameFace(const FaceKey &o) const { return a == o.a && b == o.b && c == o.c; }
+        };
+        std::vector<FaceKey> faceKeys(4 * (size_t)nTet);
         Kokkos::parallel_for(
-            "BuildNeighbors", rangePolicy,
-            KOKKOS_CLASS_LAMBDA(const int i, const int j)
+            "BuildFaceKeys", Kokkos::RangePolicy<HostExec>(0, nTet),
+            [&](const int i)
             {
-                if (i == j) return;
-                int count = 0;
-                if (pyramids(i).p1 == pyramids(j).p1 || pyramids(i).p1 == pyramids(j).p2 ||
-                    pyramids(i).p1 == pyramids(j).p3 || pyramids(i).p1 == pyramids(j).p4)
-                {
-                    count++;
-                }
-                if (pyramids(i).p2 == pyramids(j).p1 || pyramids(i).p2 == pyramids(j).p2 ||
-                    pyramids(i).p2 == pyramids(j).p3 || pyramids(i).p2 == pyramids(j).p4)
-                {
-                    count++;
-                }
-                if (pyramids(i).p3 == pyramids(j).p1 || pyramids(i).p3 == pyramids(j).p2 ||
-                    pyramids(i).p3 == pyramids(j).p3 || pyramids(i).p3 == pyramids(j).p4)
+                for (int f = 0; f < 4; f++)
                 {
-                    count++;
+                    Index v[3] = {tets(i)[TetFaceVertex(f, 0)], tets(i)[TetFaceVertex(f, 1)],
+                                  tets(i)[TetFaceVertex(f, 2)]};
+                    std::sort(v, v + 3);
+                    faceKeys[4 * (size_t)i + f] = FaceKey{v[0], v[1], v[2], i, f};
                 }
-                if (pyramids(i).p4 == pyramids(j).p1 || pyramids(i).p4 == pyramids(j).p2 ||
-                    pyramids(i).p4 == pyramids(j).p3 || pyramids(i).p4 == pyramids(j).p4)
-                {
-                    count++;
-                }
-                if (count == 3)
+            });
+        std::sort(faceKeys.begin(), faceKeys.end());
+        // 表面单元同样以排序后的顶点索引为键, 用于给边界面标记所属的表面单元
+        auto surfaces = Kokkos::create_mirror_view_and_copy(Kokkos::HostSpace(), surfaceElements);
+        std::vector<FaceKey> surfaceKeys(surfaces.extent(0));
+        for (size_t s = 0; s < surfaceKeys.size(); s++)
+        {
+            Index v[3] = {surfaces(s).v[0], surfaces(s).v[1], surfaces(s).v[2]};
+            std::sort(v, v + 3);
+            surfaceKeys[s] = FaceKey{v[0], v[1], v[2], (Index)s, -1};
+        }
+        std::sort(surfaceKeys.begin(), surfaceKeys.end());
+        auto boundaryCode = [&](const FaceKey &key)
+        {
+            auto it = std::lower_bound(surfaceKeys.begin(), surfaceKeys.end(), FaceKey{key.a, key.b, key.c, -1, -1});
+            return it != surfaceKeys.end() && it->SameFace(key) ? BoundaryCode(it->tet) : (Index)-1;
+        };
+        auto faceNbr = Kokkos::View<Index4 *, Kokkos::HostSpace>("faceNeighborsHost", nTet);
+        // 先按行计数再前缀和, 邻接表按实际大小分配, 不截断
+        auto count_1 = Kokkos::View<size_t *, Kokkos::HostSpace>("adjacentCount_1", nTet + 1);
+        auto count_2 = Kokkos::View<size_t *, Kokkos::HostSpace>("adjacentCount_2", nTet + 1);
+        auto count_3 = Kokkos::View<size_t *, Kokkos::HostSpace>("adjacentCount_3", nTet + 1);
+        auto toCSR   = [nTet](Kokkos::View<size_t *, Kokkos::HostSpace> offsets, const char *label)
+        {
+            size_t total = 0;
+            for (Index i = 0; i <= nTet; i++)
+            {
+                size_t c   = offsets(i);
+                offsets(i) = total;
+                total += c;
+            }
+            return Kokkos::View<Index *, Kokkos::HostSpace>(label, total);
+        };
+
+        for (size_t k = 0; k < faceKeys.size();)
+        {
+            size_t end = k + 1;
+            while (end < faceKeys.size() && faceKeys[end].SameFace(faceKeys[k])) end++;
+            if (end - k > 2)
+            {
+                // 非流形网格: 面邻接没有唯一的另一侧, 传输时无法确定光子进入哪个四面体
+                throw std::runtime_error("非流形网格: 面(" + std::to_string(faceKeys[k].a) + ", " +
+                                         std::to_string(faceKeys[k].b) + ", " + std::to_string(faceKeys[k].c) +
+                                         ")被" + std::to_string(end - k) + "个四面体共用");
+            }
+            for (size_t x = k; x < end; x++) count_3(faceKeys[x].tet) += end - k - 1;
+            if (end - k == 2)
+            {
+                faceNbr(faceKeys[k].tet)[faceKeys[k].face]         = faceKeys[k + 1].tet;
+                faceNbr(faceKeys[k + 1].tet)[faceKeys[k + 1].face] = faceKeys[k].tet;
+            }
+            else if (end - k == 1)
+            {
+                faceNbr(faceKeys[k].tet)[faceKeys[k].face] = boundaryCode(faceKeys[k]);
+            }
+            k = end;
+        }
+        auto adj_3 = toCSR(count_3, "adjacentPyramids_3");
+        {
+            std::vector<size_t> cursor(count_3.data(), count_3.data() + nTet);
+            for (size_t k = 0; k < faceKeys.size();)
+            {
+                size_t end = k + 1;
+                while (end < faceKeys.size() && faceKeys[end].SameFace(faceKeys[k])) end++;
+                for (size_t x = k; x < end; x++)
                 {
-                    int index = Kokkos::atomic_fetch_add(&(adjacentPyramidsNum_3(i)), 1);
-                    if (index < MAX_NEIGHBOR_COUNT_3)
+                    for (size_t y = k; y < end; y++)
                     {
-                        adjacentPyramids_3(i, index) = j;
-                    }
-                    else
-                    {
-                        Kokkos::printf("Neighbor count exceeds the limit\n");
+                        if (x != y) adj_3(cursor[faceKeys[x].tet]++) = faceKeys[y].tet;
                     }
                 }
-                else if (count == 2)
+                k = end;
+            }
+        }
+
+        // 点/边邻接: 对四面体4个顶点的(有序)关联表做多路归并, 某个四面体出现的次数即共享顶点数
+        auto forEachSharedTet = [&](const Index i, auto &&visit)
+        {
+            Index cur[4], end[4];
+            for (int k = 0; k < 4; k++)
+            {
+                cur[k] = vtxOffsets[tets(i)[k]];
+                end[k] = vtxOffsets[tets(i)[k] + 1];
+            }
+            while (true)
+            {
+                Index j = -1;
+                for (int k = 0; k < 4; k++)
                 {
-                    int index = Kokkos::atomic_fetch_add(&(adjacentPyramidsNum_2(i)), 1);
-                    if (index < MAX_NEIGHBOR_COUNT_2)
-                    {
-                        adjacentPyramids_2(i, index) = j;
-                    }
-                    else
-                    {
-                        Kokkos::printf("Neighbor count exceeds the limit\n");
-                    }
+                    if (cur[k] < end[k] && (j == -1 || vtxTets[cur[k]] < j)) j = vtxTets[cur[k]];
                 }
-                else if (count == 1)
+                if (j == -1) break;
+                int count = 0;
+                for (int k = 0; k < 4; k++)
                 {
-                    int index = Kokkos::atomic_fetch_add(&(adjacentPyramidsNum_1(i)), 1);
-                    if (index < MAX_NEIGHBOR_COUNT_1)
-                    {
-                        adjacentPyramids_1(i, index) = j;
-                    }
-                    else
+                    if (cur[k] < end[k] && vtxTets[cur[k]] == j)
                     {
-                        Kokkos::printf("Neighbor count exceeds the limit\n");
+                        count++;
+                        cur[k]++;
                     }
                 }
+                if (j != i) visit(j, count);
+            }
+        };
+        Kokkos::parallel_for(
+            "CountVertexEdgeNeighbors", Kokkos::RangePolicy<HostExec>(0, nTet),
+            [&](const int i)
+            {
+                forEachSharedTet(i,
+                                 [&](Index, int count)
+                                 {
+                                     if (count == 2) count_2(i)++;
+                                     else if (count == 1) count_1(i)++;
+                                 });
             });
+        auto adj_1 = toCSR(count_1, "adjacentPyramids_1");
+        auto adj_2 = toCSR(count_2, "adjacentPyramids_2");
+        Kokkos::parallel_for(
+            "BuildVertexEdgeNeighbors", Kokkos::RangePolicy<HostExec>(0, nTet),
+            [&](const int i)
+            {
+                size_t next_1 = count_1(i), next_2 = count_2(i);
+                forEachSharedTet(i,
+                                 [&](Index j, int count)
+                                 {
+                                     if (count == 2) adj_2(next_2++) = j;
+                                     else if (count == 1) adj_1(next_1++) = j;
+                                 });
+            });
+
+        adjacentPyramids_1.offsets = Kokkos::create_mirror_view_and_copy(ExecSpace(), count_1);
+        adjacentPyramids_1.indices = Kokkos::create_mirror_view_and_copy(ExecSpace(), adj_1);
+        adjacentPyramids_2.offsets = Kokkos::create_mirror_view_and_copy(ExecSpace(), count_2);
+        adjacentPyramids_2.indices = Kokkos::create_mirror_view_and_copy(ExecSpace(), adj_2);
+        adjacentPyramids_3.offsets = Kokkos::create_mirror_view_and_copy(ExecSpace(), count_3);
+        adjacentPyramids_3.indices = Kokkos::create_mirror_view_and_copy(ExecSpace(), adj_3);
+        faceNeighbors              = Kokkos::create_mirror_view_and_copy(ExecSpace(), faceNbr);
     }
-    TetMesh(const std::string &filename){
-        Init(filename);
-    }
-    void Init(const std::string &filename)
-    {
-        load_from_file(filename);
-        adjacentPyramidsNum_1 = Kokkos::View<int *, ExecSpace>("adjacentPyramidsNum_1", pyramids.extent(0));
-        adjacentPyramidsNum_2 = Kokkos::View<int *, ExecSpace>("adjacentPyramidsNum_2", pyramids.extent(0));
-        adjacentPyramidsNum_3 = Kokkos::View<int *, ExecSpace>("adjacentPyramidsNum_3", pyramids.extent(0));
-        Kokkos::parallel_for("InitadjacentPyramidsNum_1", pyramids.extent(0), KOKKOS_CLASS_LAMBDA (const unsigned int i) {
-            adjacentPyramidsNum_1(i) = 0;
-            adjacentPyramidsNum_2(i) = 0;
-            adjacentPyramidsNum_3(i) = 0;
-        });
-        adjacentPyramids_3 = Kokkos::View<int *[MAX_NEIGHBOR_COUNT_3], ExecSpace>("adjacentPyramids_3", pyramids.extent(0));
-        adjacentPyramids_2 = Kokkos::View<int *[MAX_NEIGHBOR_COUNT_2], ExecSpace>("adjacentPyramids_2", pyramids.extent(0));
-        adjacentPyramids_1 = Kokkos::View<int *[MAX_NEIGHBOR_COUNT_1], ExecSpace>("adjacentPyramids_1", pyramids.extent(0));
+    // 在host上构建四面体和边界面的BVH, 之后只读地驻留在设备上
+    void buildSpatialIndex()
+    {
+        Kokkos::Profiling::ScopedRegion region("TetMesh::buildSpatialIndex");
+        auto tets        = Kokkos::create_mirror_view_and_copy(Kokkos::HostSpace(), tetVertices);
+        auto points      = Kokkos::create_mirror_view_and_copy(Kokkos::HostSpace(), vertices);
+        auto neighbors   = Kokkos::create_mirror_view_and_copy(Kokkos::HostSpace(), faceNeighbors);
+        const Index nTet = NumTets();
+        std::vector<AABB> tetBoxes(nTet), faceBoxes;
+        std::vector<Index> tetIds(nTet), faceIds;
+        for (Index i = 0; i < nTet; i++)
+        {
+            for (int k = 0; k < 4; k++) tetBoxes[i].Expand(points(tets(i)[k]));
+            tetIds[i] = i;
+            for (int f = 0; f < 4; f++)
+            {
+                if (neighbors(i)[f] >= 0) continue;
+                AABB box;
+                for (int k = 0; k < 3; k++) box.Expand(points(tets(i)[TetFaceVertex(f, k)]));
+                faceBoxes.push_back(box);
+                faceIds.push_back(4 * i + f);
+            }
+        }
+        tetTree.Build(tetBoxes, tetIds, "tetTree");
+        boundaryTree.Build(faceBoxes, faceIds, "boundaryTree");
+    }
+    // 缓存格式版本, 缓存中任何数组的布局或含义变化时都需要加1
+    static constexpr uint32_t CACHE_VERSION = 4;
+    typedef struct CacheMeta
+    {
+        uint64_t numVertices    = 0;
+        uint64_t numTets        = 0;
+        uint64_t numSurfaces    = 0;
+        uint64_t numDescriptors = 0;
+        Scalar minLength        = REALMAX;
+        uint32_t hasMinLength   = 0;
+        uint32_t sizeofPoint    = sizeof(Point);
+        uint32_t sizeofIndex4   = sizeof(Index4);
+        uint32_t sizeofTetFaces = sizeof(TetFaces);
+        uint32_t sizeofSurface  = sizeof(SurfaceElement);
+        uint32_t sizeofBVHNode  = sizeof(BVHNode);
+    } CacheMeta;
+    template <class T>
+    static bool CacheSection(const MeshCacheFile::Reader &reader, uint32_t k, size_t n, const char *label,
+                             Kokkos::View<T *, ExecSpace> &view)
+    {
+        const void *data = reader.Get(k, n * sizeof(T));
+        if (!data) return false;
+        Kokkos::View<const T *, Kokkos::HostSpace, Kokkos::MemoryTraits<Kokkos::Unmanaged>> mapped((const T *)data, n);
+        view = Kokkos::View<T *, ExecSpace>(Kokkos::view_alloc(Kokkos::WithoutInitializing, label), n);
+        Kokkos::deep_copy(view, mapped);
+        return true;
+    }
+    // 从mmap的缓存直接拷贝到设备, 跳过文本解析和邻接表构建
+    bool LoadCache(const std::string &cachePath)
+    {
+        Kokkos::Profiling::ScopedRegion region("TetMesh::LoadCache");
+        MeshCacheFile::Reader reader;
+        if (!reader.Open(cachePath, CACHE_VERSION)) return false;
+        const CacheMeta *stored = (const CacheMeta *)reader.Get(0, sizeof(CacheMeta));
+        const CacheMeta expected;
+        if (!stored || stored->sizeofPoint != expected.sizeofPoint || stored->sizeofIndex4 != expected.sizeofIndex4 ||
+            stored->sizeofTetFaces != expected.sizeofTetFaces || stored->sizeofSurface != expected.sizeofSurface ||
+            stored->sizeofBVHNode != expected.sizeofBVHNode)
+        {
+            return false;
+        }
+        const size_t nVtx = stored->numVertices;
+        const size_t nTet = stored->numTets;
+        bool ok           = CacheSection(reader, 1, nVtx, "vertices", vertices) &&
+                  CacheSection(reader, 2, nTet, "tetVertices", tetVertices) &&
+                  CacheSection(reader, 3, nTet, "tetMaterials", tetMaterials) &&
+                  CacheSection(reader, 4, nTet, "tetFaces", tetFaces) &&
+                  CacheSection(reader, 5, nTet, "faceNeighbors", faceNeighbors) &&
+                  CacheSection(reader, 12, stored->numSurfaces, "surfaceElements", surfaceElements);
+        Adjacency *adjacency[3] = {&adjacentPyramids_1, &adjacentPyramids_2, &adjacentPyramids_3};
+        for (int c = 0; c < 3 && ok; c++)
+        {
+            const uint32_t k = 6 + 2 * c;
+            ok = CacheSection(reader, k, nTet + 1, "adjacentOffsets", adjacency[c]->offsets) &&
+                 CacheSection(reader, k + 1, reader.Bytes(k + 1) / sizeof(Index), "adjacentPyramids",
+                              adjacency[c]->indices);
+        }
+        BVH *trees[2] = {&tetTree, &boundaryTree};
+        for (int c = 0; c < 2 && ok; c++)
+        {
+            const uint32_t k = 14 + 2 * c;
+            ok = CacheSection(reader, k, reader.Bytes(k) / sizeof(BVHNode), "bvhNodes", trees[c]->nodes) &&
+                 CacheSection(reader, k + 1, reader.Bytes(k + 1) / sizeof(Index), "bvhItems", trees[c]->items);
+        }
+        const void *descriptors = reader.Get(13, stored->numDescriptors * sizeof(FaceDescriptor));
+        if (!ok || !descriptors) return false;
+        faceDescriptors = Kokkos::View<FaceDescriptor *, Kokkos::HostSpace>("faceDescriptors", stored->numDescriptors);
+        std::memcpy(faceDescriptors.data(), descriptors, stored->numDescriptors * sizeof(FaceDescriptor));
+        minLength    = stored->minLength;
+        hasMinLength = stored->hasMinLength != 0;
+        return true;
+    }
+    bool SaveCache(const std::string &cachePath) const
+    {
+        Kokkos::Profiling::ScopedRegion region("TetMesh::SaveCache");
+        CacheMeta meta;
+        meta.numVertices    = vertices.extent(0);
+        meta.numTets        = tetVertices.extent(0);
+        meta.numSurfaces    = surfaceElements.extent(0);
+        meta.numDescriptors = faceDescriptors.extent(0);
+        meta.minLength      = minLength;
+        meta.hasMinLength   = hasMinLength ? 1 : 0;
 
+        auto vertices_h      = Kokkos::create_mirror_view_and_copy(Kokkos::HostSpace(), vertices);
+        auto tetVertices_h   = Kokkos::create_mirror_view_and_copy(Kokkos::HostSpace(), tetVertices);
+        auto tetMaterials_h  = Kokkos::create_mirror_view_and_copy(Kokkos::HostSpace(), tetMaterials);
+        auto tetFaces_h      = Kokkos::create_mirror_view_and_copy(Kokkos::HostSpace(), tetFaces);
+        auto faceNeighbors_h = Kokkos::create_mirror_view_and_copy(Kokkos::HostSpace(), faceNeighbors);
+        MeshCacheFile::Writer writer;
+        writer.Add(&meta, sizeof(meta));
+        writer.Add(vertices_h.data(), vertices_h.extent(0) * sizeof(Point));
+        writer.Add(tetVertices_h.data(), tetVertices_h.extent(0) * sizeof(Index4));
+        writer.Add(tetMaterials_h.data(), tetMaterials_h.extent(0) * sizeof(uint8_t));
+        writer.Add(tetFaces_h.data(), tetFaces_h.extent(0) * sizeof(TetFaces));
+        writer.Add(faceNeighbors_h.data(), faceNeighbors_h.extent(0) * sizeof(Index4));
+        const Adjacency *adjacency[3] = {&adjacentPyramids_1, &adjacentPyramids_2, &adjacentPyramids_3};
+        Kokkos::View<size_t *, Kokkos::HostSpace> offsets_h[3];
+        Kokkos::View<Index *, Kokkos::HostSpace> indices_h[3];
+        for (int c = 0; c < 3; c++)
+        {
+            offsets_h[c] = Kokkos::create_mirror_view_and_copy(Kokkos::HostSpace(), adjacency[c]->offsets);
+            indices_h[c] = Kokkos::create_mirror_view_and_copy(Kokkos::HostSpace(), adjacency[c]->indices);
+            writer.Add(offsets_h[c].data(), offsets_h[c].extent(0) * sizeof(size_t));
+            writer.Add(indices_h[c].data(), indices_h[c].extent(0) * sizeof(Index));
+        }
+        auto surfaceElements_h = Kokkos::create_mirror_view_and_copy(Kokkos::HostSpace(), surfaceElements);
+        writer.Add(surfaceElements_h.data(), surfaceElements_h.extent(0) * sizeof(SurfaceElement));
+        writer.Add(faceDescriptors.data(), faceDescriptors.extent(0) * sizeof(FaceDescriptor));
+        const BVH *trees[2] = {&tetTree, &boundaryTree};
+        Kokkos::View<BVHNode *, Kokkos::HostSpace> nodes_h[2];
+        Kokkos::View<Index *, Kokkos::HostSpace> items_h[2];
+        for (int c = 0; c < 2; c++)
+        {
+            nodes_h[c] = Kokkos::create_mirror_view_and_copy(Kokkos::HostSpace(), trees[c]->nodes);
+            items_h[c] = Kokkos::create_mirror_view_and_copy(Kokkos::HostSpace(), trees[c]->items);
+            writer.Add(nodes_h[c].data(), nodes_h[c].extent(0) * sizeof(BVHNode));
+            writer.Add(items_h[c].data(), items_h[c].extent(0) * sizeof(Index));
+        }
+        return writer.Write(cachePath, CACHE_VERSION);
+    }
+    TetMesh() = default;
+    TetMesh(const std::string &filename, bool useCache = true){
+        Init(filename, useCache);
+    }
+    // 由内存中的网格(如MeshGenerator生成的)构建, 不读写缓存; 材料只有环境介质, 需要调用SetMaterials设置
+    explicit TetMesh(NetgenReader::Result mesh, const std::string &name = "memory")
+    {
+        load_from_memory(std::move(mesh), name);
+        Build();
+        SetMaterials({});
+    }
+    // 由顶点和四面体建立邻接表、空间索引和最短棱长
+    void Build()
+    {
         buildNeighbors();
+        buildSpatialIndex();
+        requireMinLength();
+    }
+    // useCache为true时优先读取 <filename>.cache, 缓存缺失或早于网格文件时重新生成.
+    // 材料表不进缓存: 存在同名.mat文件时从中读取, 否则只有环境介质, 需要调用SetMaterials设置
+    void Init(const std::string &filename, bool useCache = true)
+    {
+        const std::string cachePath = MeshCacheFile::PathFor(filename);
+        if (!useCache || !MeshCacheFile::IsFresh(filename, cachePath) || !LoadCache(cachePath))
+        {
+            load_from_file(filename);
+            Build();
+            if (useCache && !SaveCache(cachePath))
+            {
+                Kokkos::printf("[TetMesh WARNING] 无法写入网格缓存: %s\n", cachePath.c_str());
+            }
+        }
+        const std::string materialPath = MaterialTable::PathFor(filename);
+        if (std::ifstream(materialPath).good())
+        {
+            LoadMaterials(materialPath);
+        }
+        else
+        {
+            SetMaterials({});
+        }
     }
 };
 #endif
\ No newline at end of file
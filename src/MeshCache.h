@@ -0,0 +1,193 @@
+#ifndef MESHCACHE_H
+#define MESHCACHE_H
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "Utils.h"
+
+// 预处理网格的二进制缓存文件
+// 文件布局: Header | section 0 | section 1 | ..., 每个section按64字节对齐,
+// Header中记录版本号、各section的偏移/长度以及全部section的校验和.
+// 读取时整个文件mmap到内存, section可以直接作为非托管View拷贝到设备.
+class MeshCacheFile
+{
+   public:
+    static constexpr char MAGIC[8]          = {'M', 'C', 'K', 'M', 'E', 'S', 'H', '\0'};
+    static constexpr uint32_t MAX_SECTIONS  = 32;
+    static constexpr uint64_t SECTION_ALIGN = 64;
+
+    typedef struct Section
+    {
+        uint64_t offset = 0;
+        uint64_t bytes  = 0;
+    } Section;
+    typedef struct Header
+    {
+        char magic[8]        = {0};
+        uint32_t version     = 0;
+        uint32_t numSections = 0;
+        uint64_t fileBytes   = 0;
+        uint64_t checksum    = 0;
+        Section sections[MAX_SECTIONS];
+    } Header;
+
+    // 按64位字做FNV-1a, 尾部不足8字节的按字节处理
+    static uint64_t Checksum(const unsigned char *data, uint64_t bytes, uint64_t hash = 1469598103934665603ULL)
+    {
+        constexpr uint64_t prime = 1099511628211ULL;
+        uint64_t i               = 0;
+        for (; i + 8 <= bytes; i += 8)
+        {
+            uint64_t word;
+            std::memcpy(&word, data + i, 8);
+            hash = (hash ^ word) * prime;
+        }
+        for (; i < bytes; i++) hash = (hash ^ data[i]) * prime;
+        return hash;
+    }
+
+    // 几何精度为double时缓存的布局不同, 单独存放, 避免不同精度的程序交替运行时反复重建
+    static std::string PathFor(const std::string &meshPath)
+    {
+        return meshPath + (sizeof(Scalar) == sizeof(float) ? ".cache" : ".f64.cache");
+    }
+
+    // 缓存存在且不早于原始网格文件时认为有效
+    static bool IsFresh(const std::string &meshPath, const std::string &cachePath)
+    {
+        std::error_code ec;
+        if (!std::filesystem::exists(cachePath, ec)) return false;
+        if (!std::filesystem::exists(meshPath, ec)) return true;
+        auto meshTime  = std::filesystem::last_write_time(meshPath, ec);
+        auto cacheTime = std::filesystem::last_write_time(cachePath, ec);
+        return !ec && cacheTime >= meshTime;
+    }
+
+    class Writer
+    {
+       public:
+        void Add(const void *data, uint64_t bytes) { m_sections.push_back({data, bytes}); }
+
+        // 先写临时文件再rename, 并发启动的作业不会读到写了一半的缓存
+        bool Write(const std::string &path, uint32_t version) const
+        {
+            if (m_sections.size() > MAX_SECTIONS) return false;
+            Header header;
+            std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+            header.version     = version;
+            header.numSections = (uint32_t)m_sections.size();
+            uint64_t offset    = Align(sizeof(Header));
+            header.checksum    = Checksum(nullptr, 0);
+            for (size_t k = 0; k < m_sections.size(); k++)
+            {
+                header.sections[k] = {offset, m_sections[k].bytes};
+                header.checksum    = Checksum((const unsigned char *)m_sections[k].data, m_sections[k].bytes,
+                                              header.checksum);
+                offset             = Align(offset + m_sections[k].bytes);
+            }
+            header.fileBytes = offset;
+
+            std::string tmpPath = path + ".tmp" + std::to_string(::getpid());
+            FILE *file          = std::fopen(tmpPath.c_str(), "wb");
+            if (!file) return false;
+            bool ok         = std::fwrite(&header, 1, sizeof(Header), file) == sizeof(Header);
+            uint64_t cursor = sizeof(Header);
+            for (size_t k = 0; k < m_sections.size() && ok; k++)
+            {
+                ok = WriteZeros(file, header.sections[k].offset - cursor) &&
+                     std::fwrite(m_sections[k].data, 1, m_sections[k].bytes, file) == m_sections[k].bytes;
+                cursor = header.sections[k].offset + m_sections[k].bytes;
+            }
+            ok = ok && WriteZeros(file, header.fileBytes - cursor);
+            ok = (std::fclose(file) == 0) && ok;
+            if (ok) ok = std::rename(tmpPath.c_str(), path.c_str()) == 0;
+            if (!ok) std::remove(tmpPath.c_str());
+            return ok;
+        }
+
+       private:
+        struct Pending
+        {
+            const void *data;
+            uint64_t bytes;
+        };
+        std::vector<Pending> m_sections;
+        static uint64_t Align(uint64_t x) { return (x + SECTION_ALIGN - 1) / SECTION_ALIGN * SECTION_ALIGN; }
+        static bool WriteZeros(FILE *file, uint64_t bytes)
+        {
+            static const char zeros[SECTION_ALIGN] = {0};
+            return bytes < SECTION_ALIGN && std::fwrite(zeros, 1, bytes, file) == bytes;
+        }
+    };
+
+    // 只读mmap整个缓存文件, 析构时解除映射
+    class Reader
+    {
+       public:
+        Reader() = default;
+        Reader(const Reader &)            = delete;
+        Reader &operator=(const Reader &) = delete;
+        ~Reader()
+        {
+            if (m_data) ::munmap(m_data, m_bytes);
+        }
+        bool Open(const std::string &path, uint32_t version)
+        {
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0) return false;
+            struct stat st;
+            if (::fstat(fd, &st) != 0 || (uint64_t)st.st_size < sizeof(Header))
+            {
+                ::close(fd);
+                return false;
+            }
+            m_bytes = (uint64_t)st.st_size;
+            m_data  = ::mmap(nullptr, m_bytes, PROT_READ, MAP_SHARED, fd, 0);
+            ::close(fd);
+            if (m_data == MAP_FAILED)
+            {
+                m_data = nullptr;
+                return false;
+            }
+            const Header &header = GetHeader();
+            if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != version ||
+                header.fileBytes != m_bytes || header.numSections > MAX_SECTIONS)
+            {
+                return false;
+            }
+            uint64_t checksum = Checksum(nullptr, 0);
+            for (uint32_t k = 0; k < header.numSections; k++)
+            {
+                const Section &section = header.sections[k];
+                if (section.offset + section.bytes > m_bytes) return false;
+                checksum = Checksum((const unsigned char *)m_data + section.offset, section.bytes, checksum);
+            }
+            m_valid = checksum == header.checksum;
+            return m_valid;
+        }
+        uint32_t NumSections() const { return m_valid ? GetHeader().numSections : 0; }
+        // 取第k个section, 长度不等于expectedBytes时返回nullptr
+        const void *Get(uint32_t k, uint64_t expectedBytes) const
+        {
+            if (!m_valid || k >= GetHeader().numSections) return nullptr;
+            const Section &section = GetHeader().sections[k];
+            if (section.bytes != expectedBytes) return nullptr;
+            return (const char *)m_data + section.offset;
+        }
+        uint64_t Bytes(uint32_t k) const { return k < NumSections() ? GetHeader().sections[k].bytes : 0; }
+
+       private:
+        void *m_data     = nullptr;
+        uint64_t m_bytes = 0;
+        bool m_valid     = false;
+        const Header &GetHeader() const { return *(const Header *)m_data; }
+    };
+};
+#endif
@@ -0,0 +1,241 @@
+#ifndef MESHGENERATOR_H
+#define MESHGENERATOR_H
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "Geometry.h"
+#include "NetgenReader.h"
+
+// 基准用的合成四面体网格. 规则格子的每个立方体按Kuhn(Freudenthal)剖分切成6个四面体,
+// 所有立方体沿同一条对角线剖分, 相邻立方体的公共面自动协调.
+// 结果与NetgenReader::Result相同, 可以直接交给TetMesh, 也可以用WriteNetgen写成.vol文件.
+// 域编号从1开始按层给出; 外边界的三角形作为表面单元给出, 层间界面不生成表面单元.
+class MeshGenerator
+{
+   public:
+    // 层状平板: x, y ∈ [-width/2, width/2], z ∈ [0, Σthickness], 从z = 0起第l层的域编号为l + 1.
+    // 单元尺寸按targetTets取为近似立方体, 每层至少一个单元, 层界面落在格点平面上.
+    // 表面单元的bcnr: 1为z = 0的入射面, 2为底面, 3为侧面
+    static NetgenReader::Result Slab(size_t targetTets, const std::vector<Scalar> &thickness, Scalar width)
+    {
+        if (thickness.empty() || width <= 0) throw std::runtime_error("平板网格需要至少一层且宽度为正");
+        double depth = 0;
+        for (Scalar t : thickness)
+        {
+            if (t <= 0) throw std::runtime_error("平板网格的层厚必须为正");
+            depth += t;
+        }
+        const double h = std::cbrt((double)width * width * depth / std::max<double>((double)targetTets / 6, 1));
+        const int n    = std::max(1, (int)std::lround(width / h));
+        // z方向的格点坐标, 每层按各自的厚度均分
+        std::vector<double> zs{0};
+        std::vector<int> layerOfCell;
+        for (size_t l = 0; l < thickness.size(); l++)
+        {
+            const int cells = std::max(1, (int)std::lround(thickness[l] / h));
+            const double z0 = zs.back();
+            for (int c = 1; c <= cells; c++)
+            {
+                zs.push_back(z0 + (double)thickness[l] * c / cells);
+                layerOfCell.push_back((int)l);
+            }
+        }
+        const int nz = (int)layerOfCell.size();
+        Lattice lattice{n, n, nz};
+        NetgenReader::Result result;
+        result.points.resize(lattice.NumNodes());
+        for (int k = 0; k <= nz; k++)
+        {
+            for (int j = 0; j <= n; j++)
+            {
+                for (int i = 0; i <= n; i++)
+                {
+                    result.points[lattice.Node(i, j, k)] =
+                        Point{(Scalar)(width * ((double)i / n - 0.5)), (Scalar)(width * ((double)j / n - 0.5)),
+                              (Scalar)zs[k]};
+                }
+            }
+        }
+        Triangulate(
+            lattice, result, [&](int, int, int k) { return layerOfCell[k] + 1; },
+            [&](int axis, bool high) { return axis == 2 ? (high ? 2 : 1) : 3; });
+        return result;
+    }
+    // 同心球: 第l层为半径(radii[l-1], radii[l]]的球壳(第0层为半径radii[0]的球), 域编号l + 1; 外表面bcnr为1.
+    // [-m, m]³的立方体格子按 p -> p·|p|∞/|p|₂ 映射到球上, |p|∞相同的格点落在同一球面上,
+    // 每个立方体夹在相邻两个球面之间, 层界面与网格面重合. 球心在原点
+    static NetgenReader::Result Sphere(size_t targetTets, const std::vector<Scalar> &radii)
+    {
+        if (radii.empty() || radii[0] <= 0) throw std::runtime_error("球网格需要至少一层且半径为正");
+        for (size_t l = 1; l < radii.size(); l++)
+        {
+            if (radii[l] <= radii[l - 1]) throw std::runtime_error("球网格的半径必须递增");
+        }
+        // 共有48m³个四面体, 每层至少占一个球壳
+        const int m = std::max((int)radii.size(), (int)std::lround(std::cbrt((double)targetTets / 48)));
+        // 第s个球面(s = 0..m)的半径, 每层按厚度分配球壳数
+        std::vector<double> shellRadius{0};
+        std::vector<int> layerOfShell;
+        const double outer = radii.back();
+        int assigned       = 0;
+        for (size_t l = 0; l < radii.size(); l++)
+        {
+            const double r0   = l == 0 ? 0 : radii[l - 1];
+            const int left    = (int)(radii.size() - l - 1);
+            const int desired = (int)std::lround(m * (radii[l] - r0) / outer);
+            const int shells  = l + 1 == radii.size() ? m - assigned : std::clamp(desired, 1, m - assigned - left);
+            for (int c = 1; c <= shells; c++)
+            {
+                shellRadius.push_back(r0 + (radii[l] - r0) * c / shells);
+                layerOfShell.push_back((int)l);
+            }
+            assigned += shells;
+        }
+        Lattice lattice{2 * m, 2 * m, 2 * m};
+        NetgenReader::Result result;
+        result.points.resize(lattice.NumNodes());
+        for (int k = 0; k <= 2 * m; k++)
+        {
+            for (int j = 0; j <= 2 * m; j++)
+            {
+                for (int i = 0; i <= 2 * m; i++)
+                {
+                    const int x = i - m, y = j - m, z = k - m;
+                    const int s = std::max({std::abs(x), std::abs(y), std::abs(z)});
+                    const double scale =
+                        s == 0 ? 0 : shellRadius[s] / std::sqrt((double)x * x + (double)y * y + (double)z * z);
+                    result.points[lattice.Node(i, j, k)] =
+                        Point{(Scalar)(x * scale), (Scalar)(y * scale), (Scalar)(z * scale)};
+                }
+            }
+        }
+        // 格子[a, a + 1]上|p|∞的范围为[s, s + 1], s为各轴上离原点较近一端的最大值
+        auto innerShell = [m](int i, int j, int k)
+        {
+            auto near = [m](int a) { return a - m >= 0 ? a - m : m - a - 1; };
+            return std::max({near(i), near(j), near(k)});
+        };
+        Triangulate(
+            lattice, result, [&](int i, int j, int k) { return layerOfShell[innerShell(i, j, k)] + 1; },
+            [](int, bool) { return 1; });
+        return result;
+    }
+    // 写成NETGEN .vol格式(只含NetgenReader读取的段), 用于测量真实的读取路径
+    static void WriteNetgen(const NetgenReader::Result &mesh, const std::string &path)
+    {
+        FILE *file = std::fopen(path.c_str(), "w");
+        if (!file) throw std::runtime_error("无法写入文件: " + path);
+        std::fprintf(file, "mesh3d\ndimension\n3\ngeomtype\n0\n\n");
+        std::fprintf(file, "# surfnr\tdomin\tdomout\ttlosurf\tbcprop\nfacedescriptors\n%zu\n",
+                     mesh.faceDescriptors.size());
+        for (const FaceDescriptor &d : mesh.faceDescriptors)
+        {
+            std::fprintf(file, "%d %d %d %d %d\n", d.surfnr, d.domin, d.domout, d.tlosurf, d.bcprop);
+        }
+        std::fprintf(file, "\n# surfnr    bcnr   domin  domout      np      p1      p2      p3\nsurfaceelements\n%zu\n",
+                     mesh.surfaces.size());
+        for (const SurfaceElement &s : mesh.surfaces)
+        {
+            std::fprintf(file, " %d %d %d %d 3 %d %d %d\n", s.surfnr, s.bcnr, s.domin, s.domout, s.v[0] + 1, s.v[1] + 1,
+                         s.v[2] + 1);
+        }
+        std::fprintf(file, "\n#  matnr      np      p1      p2      p3      p4\nvolumeelements\n%zu\n", mesh.tets.size());
+        for (size_t i = 0; i < mesh.tets.size(); i++)
+        {
+            const Index4 &v = mesh.tets[i];
+            std::fprintf(file, "%d 4 %d %d %d %d\n", mesh.tetDomains[i], v[0] + 1, v[1] + 1, v[2] + 1, v[3] + 1);
+        }
+        const int digits = std::numeric_limits<Scalar>::max_digits10;
+        std::fprintf(file, "\n#          X             Y             Z\npoints\n%zu\n", mesh.points.size());
+        for (const Point &p : mesh.points)
+        {
+            std::fprintf(file, "%.*g %.*g %.*g\n", digits, (double)p.x, digits, (double)p.y, digits, (double)p.z);
+        }
+        std::fprintf(file, "\nendmesh\n");
+        if (std::fclose(file) != 0) throw std::runtime_error("写入文件失败: " + path);
+    }
+
+   private:
+    // (nx + 1) × (ny + 1) × (nz + 1)个格点, 按x最快编号
+    typedef struct Lattice
+    {
+        int nx, ny, nz;
+        size_t NumNodes() const { return (size_t)(nx + 1) * (ny + 1) * (nz + 1); }
+        Index Node(int i, int j, int k) const { return (Index)(i + (size_t)(nx + 1) * (j + (size_t)(ny + 1) * k)); }
+    } Lattice;
+
+    // 逐个立方体切成6个四面体: 沿轴的排列π走 000 -> e_π0 -> e_π0 + e_π1 -> 111.
+    // domainOf(i, j, k)给出立方体的域编号, bcnrOf(axis, high)给出落在格子外表面 axis = 0/max 上的三角形的bcnr
+    template <class DomainOf, class BcnrOf>
+    static void Triangulate(const Lattice &lattice, NetgenReader::Result &result, const DomainOf &domainOf,
+                            const BcnrOf &bcnrOf)
+    {
+        static constexpr int PERMUTATIONS[6][2] = {{0, 1}, {0, 2}, {1, 0}, {1, 2}, {2, 0}, {2, 1}};
+        const int size[3]                       = {lattice.nx, lattice.ny, lattice.nz};
+        const size_t numCells                   = (size_t)lattice.nx * lattice.ny * lattice.nz;
+        const size_t maxIndex                   = (size_t)std::numeric_limits<Index>::max();
+        if (6 * numCells > maxIndex || lattice.NumNodes() > maxIndex)
+        {
+            throw std::runtime_error("合成网格超出Index的范围");
+        }
+        result.tets.reserve(6 * numCells);
+        result.tetDomains.reserve(6 * numCells);
+        // 每个bcnr一个face descriptor, 表面单元的surfnr为其编号(从1开始)
+        std::vector<int> surfnrOfBcnr;
+        for (int k = 0; k < lattice.nz; k++)
+        {
+            for (int j = 0; j < lattice.ny; j++)
+            {
+                for (int i = 0; i < lattice.nx; i++)
+                {
+                    const int domain = domainOf(i, j, k);
+                    for (const auto &perm : PERMUTATIONS)
+                    {
+                        int c[4][3] = {{i, j, k}, {i, j, k}, {i, j, k}, {i + 1, j + 1, k + 1}};
+                        c[1][perm[0]]++;
+                        c[2][perm[0]]++;
+                        c[2][perm[1]]++;
+                        Index4 tet;
+                        for (int v = 0; v < 4; v++) tet[v] = lattice.Node(c[v][0], c[v][1], c[v][2]);
+                        result.tets.push_back(tet);
+                        result.tetDomains.push_back(domain);
+                        // 面上3个顶点在同一外表面上时为边界面
+                        for (int f = 0; f < 4; f++)
+                        {
+                            const int *a = c[TetFaceVertex(f, 0)], *b = c[TetFaceVertex(f, 1)],
+                                      *d = c[TetFaceVertex(f, 2)];
+                            for (int axis = 0; axis < 3; axis++)
+                            {
+                                if (a[axis] != b[axis] || a[axis] != d[axis]) continue;
+                                if (a[axis] != 0 && a[axis] != size[axis]) continue;
+                                const int bcnr = bcnrOf(axis, a[axis] != 0);
+                                if ((int)surfnrOfBcnr.size() <= bcnr) surfnrOfBcnr.resize(bcnr + 1, 0);
+                                if (surfnrOfBcnr[bcnr] == 0)
+                                {
+                                    result.faceDescriptors.push_back(FaceDescriptor{
+                                        (int)result.faceDescriptors.size() + 1, domain, 0, 0, bcnr});
+                                    surfnrOfBcnr[bcnr] = (int)result.faceDescriptors.size();
+                                }
+                                SurfaceElement s;
+                                s.v[0]   = tet[TetFaceVertex(f, 0)];
+                                s.v[1]   = tet[TetFaceVertex(f, 1)];
+                                s.v[2]   = tet[TetFaceVertex(f, 2)];
+                                s.surfnr = surfnrOfBcnr[bcnr];
+                                s.bcnr   = bcnr;
+                                s.domin  = domain;
+                                s.domout = 0;
+                                result.surfaces.push_back(s);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+};
+#endif
@@ -0,0 +1,248 @@
+#ifndef NETGENREADER_H
+#define NETGENREADER_H
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "Utils.h"
+
+// NETGEN surfaceelements中的一个三角形, 顶点索引已转为从0开始
+typedef struct SurfaceElement
+{
+    Index v[3]  = {-1, -1, -1};
+    int surfnr  = 0;
+    int bcnr    = 0;
+    int domin   = 0;
+    int domout  = 0;
+} SurfaceElement;
+
+// NETGEN facedescriptors中的一行
+typedef struct FaceDescriptor
+{
+    int surfnr  = 0;
+    int domin   = 0;
+    int domout  = 0;
+    int tlosurf = 0;
+    int bcprop  = 0;
+} FaceDescriptor;
+
+// NETGEN .vol 读取器
+// 整个文件一次块读入内存, 先顺序定位各段的行首, 再在host执行空间上按行并行用std::from_chars解析.
+// 保留 volumeelements 的域编号、surfaceelements 的 bcnr/domin/domout 以及 facedescriptors.
+class NetgenReader
+{
+   public:
+    typedef struct Result
+    {
+        std::vector<Point> points;
+        std::vector<Index4> tets;
+        std::vector<int> tetDomains;
+        std::vector<SurfaceElement> surfaces;
+        std::vector<FaceDescriptor> faceDescriptors;
+        size_t bytes   = 0;
+        double seconds = 0;
+    } Result;
+
+    static Result Read(const std::string &filename)
+    {
+        Kokkos::Timer timer;
+        Result result;
+        std::vector<char> buffer = ReadFile(filename);
+        result.bytes             = buffer.size();
+        const char *begin        = buffer.data();
+        const char *end          = begin + buffer.size();
+
+        const char *cursor = begin;
+        while (cursor < end)
+        {
+            std::string_view line = NextLine(cursor, end);
+            std::string_view key  = Trim(line);
+            if (key == "volumeelements")
+            {
+                auto lines = SectionLines(cursor, end, filename, key);
+                result.tets.resize(lines.size());
+                result.tetDomains.resize(lines.size());
+                ParseLines(lines, filename, key,
+                           [&](size_t i, const char *p, const char *e)
+                           {
+                               int matnr, np, v[4];
+                               bool ok = Parse(p, e, matnr) && Parse(p, e, np) && np >= 4;
+                               for (int k = 0; k < 4 && ok; k++) ok = Parse(p, e, v[k]);
+                               if (!ok) return false;
+                               // NETGEN的索引从1开始,需要减1
+                               result.tets[i]       = Index4{{v[0] - 1, v[1] - 1, v[2] - 1, v[3] - 1}};
+                               result.tetDomains[i] = matnr;
+                               return true;
+                           });
+            }
+            else if (key == "points")
+            {
+                auto lines = SectionLines(cursor, end, filename, key);
+                result.points.resize(lines.size());
+                ParseLines(lines, filename, key,
+                           [&](size_t i, const char *p, const char *e)
+                           {
+                               Point &point = result.points[i];
+                               return Parse(p, e, point.x) && Parse(p, e, point.y) && Parse(p, e, point.z);
+                           });
+            }
+            else if (key.substr(0, 15) == "surfaceelements")
+            {
+                // surfaceelements / surfaceelementsgi / surfaceelementsuv 的前几列相同, 之后的几何信息忽略
+                auto lines = SectionLines(cursor, end, filename, key);
+                result.surfaces.resize(lines.size());
+                ParseLines(lines, filename, key,
+                           [&](size_t i, const char *p, const char *e)
+                           {
+                               SurfaceElement &s = result.surfaces[i];
+                               int np, v[3];
+                               bool ok = Parse(p, e, s.surfnr) && Parse(p, e, s.bcnr) && Parse(p, e, s.domin) &&
+                                         Parse(p, e, s.domout) && Parse(p, e, np) && np >= 3;
+                               for (int k = 0; k < 3 && ok; k++) ok = Parse(p, e, v[k]);
+                               if (!ok) return false;
+                               for (int k = 0; k < 3; k++) s.v[k] = v[k] - 1;
+                               return true;
+                           });
+            }
+            else if (key == "facedescriptors")
+            {
+                auto lines = SectionLines(cursor, end, filename, key);
+                result.faceDescriptors.resize(lines.size());
+                ParseLines(lines, filename, key,
+                           [&](size_t i, const char *p, const char *e)
+                           {
+                               FaceDescriptor &d = result.faceDescriptors[i];
+                               return Parse(p, e, d.surfnr) && Parse(p, e, d.domin) && Parse(p, e, d.domout) &&
+                                      Parse(p, e, d.tlosurf) && Parse(p, e, d.bcprop);
+                           });
+            }
+            else if (key == "endmesh")
+            {
+                break;
+            }
+        }
+        if (result.tets.empty() || result.points.empty())
+        {
+            throw std::runtime_error("文件中缺少volumeelements或points: " + filename);
+        }
+        for (const Index4 &tet : result.tets)
+        {
+            for (int k = 0; k < 4; k++)
+            {
+                if (tet[k] < 0 || tet[k] >= (Index)result.points.size())
+                {
+                    throw std::runtime_error("四面体顶点索引越界: " + filename);
+                }
+            }
+        }
+        result.seconds = timer.seconds();
+        Kokkos::printf("[NetgenReader] %s: %.2f MB in %.3f s (%.1f MB/s), %zu points, %zu tets, %zu surface elements\n",
+                       filename.c_str(), result.bytes / 1e6, result.seconds, result.bytes / 1e6 / result.seconds,
+                       result.points.size(), result.tets.size(), result.surfaces.size());
+        return result;
+    }
+
+   private:
+    static constexpr size_t BLOCK_SIZE = size_t(64) << 20;
+
+    static std::vector<char> ReadFile(const std::string &filename)
+    {
+        FILE *file = std::fopen(filename.c_str(), "rb");
+        if (!file)
+        {
+            throw std::runtime_error("无法打开文件: " + filename);
+        }
+        std::fseek(file, 0, SEEK_END);
+        std::vector<char> buffer(std::max<long>(std::ftell(file), 0));
+        std::fseek(file, 0, SEEK_SET);
+        // 按块读入, 避免单次fread过大
+        size_t size = 0;
+        while (size < buffer.size())
+        {
+            size_t n = std::fread(buffer.data() + size, 1, std::min(BLOCK_SIZE, buffer.size() - size), file);
+            if (n == 0) break;
+            size += n;
+        }
+        std::fclose(file);
+        buffer.resize(size);
+        return buffer;
+    }
+    static std::string_view NextLine(const char *&cursor, const char *end)
+    {
+        const char *lineEnd = (const char *)std::memchr(cursor, '\n', end - cursor);
+        if (!lineEnd) lineEnd = end;
+        std::string_view line(cursor, lineEnd - cursor);
+        cursor = lineEnd < end ? lineEnd + 1 : end;
+        return line;
+    }
+    static std::string_view Trim(std::string_view s)
+    {
+        while (!s.empty() && (s.front() == ' ' || s.front() == '\t' || s.front() == '\r')) s.remove_prefix(1);
+        while (!s.empty() && (s.back() == ' ' || s.back() == '\t' || s.back() == '\r')) s.remove_suffix(1);
+        return s;
+    }
+    static bool Parse(const char *&p, const char *e, int &value)
+    {
+        while (p < e && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+        auto res = std::from_chars(p, e, value);
+        p        = res.ptr;
+        return res.ec == std::errc();
+    }
+    static bool Parse(const char *&p, const char *e, Scalar &value)
+    {
+        while (p < e && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+        auto res = std::from_chars(p, e, value);
+        p        = res.ptr;
+        return res.ec == std::errc();
+    }
+    // 读取段头的数量N, 并顺序定位其后N个非空行, 行内容留给并行解析
+    static std::vector<std::string_view> SectionLines(const char *&cursor, const char *end,
+                                                      const std::string &filename, std::string_view key)
+    {
+        std::string_view countLine;
+        while (cursor < end && (countLine = Trim(NextLine(cursor, end))).empty())
+        {
+        }
+        size_t count = 0;
+        auto res     = std::from_chars(countLine.data(), countLine.data() + countLine.size(), count);
+        if (res.ec != std::errc())
+        {
+            throw std::runtime_error("无法读取" + std::string(key) + "的数量: " + filename);
+        }
+        std::vector<std::string_view> lines;
+        lines.reserve(count);
+        while (lines.size() < count && cursor < end)
+        {
+            std::string_view line = NextLine(cursor, end);
+            if (!Trim(line).empty()) lines.push_back(line);
+        }
+        if (lines.size() != count)
+        {
+            throw std::runtime_error(std::string(key) + "段提前结束: " + filename);
+        }
+        return lines;
+    }
+    template <class Functor>
+    static void ParseLines(const std::vector<std::string_view> &lines, const std::string &filename,
+                           std::string_view key, const Functor &parseLine)
+    {
+        size_t failed = 0;
+        Kokkos::parallel_reduce(
+            "NetgenParseLines", Kokkos::RangePolicy<Kokkos::DefaultHostExecutionSpace>(0, lines.size()),
+            [&](const size_t i, size_t &localFailed)
+            {
+                const char *p = lines[i].data();
+                if (!parseLine(i, p, p + lines[i].size())) localFailed++;
+            },
+            failed);
+        if (failed > 0)
+        {
+            throw std::runtime_error(std::string(key) + "段中有" + std::to_string(failed) + "行无法解析: " + filename);
+        }
+    }
+};
+#endif
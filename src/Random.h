@@ -0,0 +1,73 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+#include <cstdint>
+#include "Utils.h"
+
+// Philox4x32-10 计数器随机数 (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3", SC'11)
+// 第n个随机数只由(seed, stream, n)决定: stream取全局光子编号, n为该光子已取的随机数个数.
+// 状态只有几个整数, 放在寄存器里随transpose_core一起传递, 不需要像Random_XorShift64_Pool那样加锁取状态,
+// 结果也与后端、线程数和调度顺序无关.
+class PhiloxRandom
+{
+   public:
+    KOKKOS_INLINE_FUNCTION
+    PhiloxRandom() = default;
+    KOKKOS_INLINE_FUNCTION
+    PhiloxRandom(uint64_t seed, uint64_t stream, uint64_t draws = 0)
+        : m_seed(seed), m_stream(stream), m_draws(draws)
+    {
+    }
+
+    // 32位均匀随机整数, 每4个共用一次Philox计算
+    KOKKOS_INLINE_FUNCTION
+    uint32_t Next()
+    {
+        const int lane = (int)(m_draws & 3);
+        if (lane == 0 || !m_valid)
+        {
+            Block(m_draws >> 2);
+            m_valid = true;
+        }
+        m_draws++;
+        return m_block[lane];
+    }
+    // (0, 1) 上的均匀分布, 不会取到0和1, 可以直接取对数
+    KOKKOS_INLINE_FUNCTION
+    Scalar Uniform() { return (Scalar)(Next() >> 9) * (Scalar)(1.0 / 8388608) + (Scalar)(1.0 / 16777216); }
+    // 已取的随机数个数, 与seed和stream一起可以恢复生成器, wavefront引擎在kernel之间只保存这个计数
+    KOKKOS_INLINE_FUNCTION
+    uint64_t Draws() const { return m_draws; }
+
+   private:
+    static constexpr uint32_t M0 = 0xD2511F53u, M1 = 0xCD9E8D57u;
+    static constexpr uint32_t W0 = 0x9E3779B9u, W1 = 0xBB67AE85u;
+    static constexpr int ROUNDS  = 10;
+
+    uint64_t m_seed   = 0;
+    uint64_t m_stream = 0;
+    uint64_t m_draws  = 0;
+    uint32_t m_block[4];
+    bool m_valid = false;
+
+    KOKKOS_INLINE_FUNCTION
+    void Block(uint64_t block)
+    {
+        uint32_t c[4] = {(uint32_t)block, (uint32_t)(block >> 32), (uint32_t)m_stream, (uint32_t)(m_stream >> 32)};
+        uint32_t k0 = (uint32_t)m_seed, k1 = (uint32_t)(m_seed >> 32);
+        for (int r = 0; r < ROUNDS; r++)
+        {
+            const uint64_t p0 = (uint64_t)M0 * c[0];
+            const uint64_t p1 = (uint64_t)M1 * c[2];
+            const uint32_t n0 = (uint32_t)(p1 >> 32) ^ c[1] ^ k0;
+            const uint32_t n2 = (uint32_t)(p0 >> 32) ^ c[3] ^ k1;
+            c[0]              = n0;
+            c[1]              = (uint32_t)p1;
+            c[2]              = n2;
+            c[3]              = (uint32_t)p0;
+            k0 += W0;
+            k1 += W1;
+        }
+        for (int i = 0; i < 4; i++) m_block[i] = c[i];
+    }
+};
+#endif
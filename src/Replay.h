@@ -0,0 +1,208 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+#include "Detector.h"
+#include "Spectral.h"
+
+// 微扰/重放蒙特卡罗(perturbation MC)
+// 传输时记录每个被探测器计入的光子在各域中的路径长度L_d和散射次数k_d(TransportOptions::recordPaths).
+// 路径的概率密度与权重之积为 Π_d μs_d^k_d * exp(-μt_d * L_d), 与逐次吸收还是光谱模式无关,
+// 因此μa/μs变为μa'/μs'后同一条路径的权重为
+//   w' = w * Π_d (μs'_d / μs_d)^k_d * exp(-(μt'_d - μt_d) * L_d)
+// 对参数的导数 ∂w'/∂μa'_d = -L_d * w', ∂w'/∂μs'_d = (k_d / μs'_d - L_d) * w'.
+// g和n改变时路径本身不同, 不能重放. 轮盘赌按原参数进行, 参数变化较大时方差增大
+typedef struct DetectedPhoton
+{
+    uint64_t seed   = 0;  // 种子和全局光子编号确定随机数流, SetSeed(seed, photon)后run(1)可重新跟踪该光子
+    uint64_t photon = 0;
+    int bin         = 0;  // 在探测器直方图中的位置
+    Accum weight    = 0;  // 原参数下计入直方图的权重
+    Scalar path[MAX_PATH_DOMAINS]       = {};
+    uint32_t scatters[MAX_PATH_DOMAINS] = {};
+} DetectedPhoton;
+
+// 新参数下的探测器信号及其对各域μa、μs的导数, 与DetectorSet::histogram的格一一对应
+typedef struct ReplayResult
+{
+    int numBins = 0;
+    std::vector<Accum> signal;  // 第b格的信号
+    std::vector<Accum> dMua;    // b * MAX_PATH_DOMAINS + (域编号 - 1): ∂signal/∂μa
+    std::vector<Accum> dMus;    // 同上: ∂signal/∂μs
+    Accum Jacobian(const std::vector<Accum> &d, int bin, int domain) const
+    {
+        return d[bin * MAX_PATH_DOMAINS + SpectralSets::Slot((uint8_t)domain)];
+    }
+} ReplayResult;
+
+// 被探测的光子的紧凑缓冲, 在设备上按批追加; 一个光子被多个探测器计入时每个探测器一条记录
+class ReplayBuffer
+{
+   public:
+    ReplayBuffer() = default;
+    // 以网格当前材料(域1..MAX_PATH_DOMAINS)为原参数
+    ReplayBuffer(const TetMesh &mesh, const DetectorSet &detectors)
+        : m_numBins((int)detectors.histogram.extent(0)), m_detectors(detectors.detectors)
+    {
+        if (detectors.Empty()) throw std::runtime_error("重放需要先设置探测器");
+        const std::vector<bool> used = PathDomains(mesh, "重放");
+        auto materials_h             = Kokkos::create_mirror_view_and_copy(Kokkos::HostSpace(), mesh.materials);
+        for (int d = 1; d <= MAX_PATH_DOMAINS; d++)
+        {
+            m_reference[d - 1] = used[d] ? materials_h(d) : Material();
+        }
+    }
+    bool Enabled() const { return m_numBins > 0; }
+    size_t Size() const { return m_count; }
+    size_t Bytes() const { return m_count * sizeof(DetectedPhoton); }
+    int NumBins() const { return m_numBins; }
+    // 有效的记录, 按光子编号和探测器的顺序排列
+    Kokkos::View<DetectedPhoton *, ExecSpace> Photons() const
+    {
+        return Kokkos::subview(m_photons, Kokkos::make_pair((size_t)0, m_count));
+    }
+    void Clear() { m_count = 0; }
+
+    // 把一批结果中被探测器计入的光子追加到缓冲, 第i个结果的全局编号为firstPhoton + i;
+    // weight(result)为该光子在原参数下的权重(光谱模式为第0组的权重)
+    template <class ResultView, class Weight>
+    void Capture(const TetMesh &mesh, const ResultView &results, uint64_t seed, uint64_t firstPhoton,
+                 const Weight &weight)
+    {
+        const size_t n = results.extent(0);
+        if (!Enabled() || n == 0) return;
+        auto detectors = m_detectors;
+        // 先数出每个光子的记录数和总数, 扩容后再按同样的顺序写入, 结果与线程数无关;
+        // out不为空时把第photon个光子的记录直接写到out开始的连续位置
+        auto hits = KOKKOS_LAMBDA(const resultType &r, DetectedPhoton *out, uint64_t photon)
+        {
+            if (r.type != CollectType::OUTOFRANGE) return 0;
+            int count = 0;
+            for (size_t d = 0; d < detectors.extent(0); d++)
+            {
+                const int k = DetectorSet::Classify(mesh, detectors(d), r);
+                if (k < 0) continue;
+                if (out)
+                {
+                    DetectedPhoton &p = out[count];
+                    p.seed            = seed;
+                    p.photon          = photon;
+                    p.bin             = detectors(d).offset + k;
+                    p.weight          = weight(r);
+                    for (int s = 0; s < MAX_PATH_DOMAINS; s++)
+                    {
+                        p.path[s]     = r.path[s];
+                        p.scatters[s] = r.scatters[s];
+                    }
+                }
+                count++;
+            }
+            return count;
+        };
+        size_t added = 0;
+        Kokkos::parallel_reduce(
+            "replay_count", Kokkos::RangePolicy<ExecSpace>(0, n),
+            KOKKOS_LAMBDA(const size_t i, size_t &local) { local += hits(results(i), nullptr, 0); }, added);
+        if (added == 0) return;
+        if (m_count + added > m_photons.extent(0))
+        {
+            Kokkos::resize(m_photons, std::max(2 * m_photons.extent(0), m_count + added));
+        }
+        // 扫描的前缀和即该光子记录在缓冲中的起始位置, 最后一遍直接写入缓冲
+        DetectedPhoton *photons = m_photons.data() + m_count;
+        Kokkos::parallel_scan(
+            "replay_capture", Kokkos::RangePolicy<ExecSpace>(0, n),
+            KOKKOS_LAMBDA(const size_t i, size_t &offset, const bool final)
+            { offset += hits(results(i), final ? photons + offset : nullptr, firstPhoton + i); });
+        m_count += added;
+    }
+
+    // 按新的属性(按域编号, 与SetMaterials的格式相同, 只使用μa和μs)一次遍历缓冲重新计算信号和雅可比矩阵
+    ReplayResult Reweight(const std::vector<Attribute> &byDomain) const
+    {
+        ReplayFunctor functor;
+        functor.value_count = (unsigned)m_numBins * (1 + 2 * MAX_PATH_DOMAINS);
+        functor.numBins     = m_numBins;
+        functor.photons     = Photons();
+        for (int s = 0; s < MAX_PATH_DOMAINS; s++)
+        {
+            const Material &ref = m_reference[s];
+            const int domain    = s + 1;
+            if (!ref.Valid()) continue;  // 网格中没有该域, 路径长度和散射次数都为0
+            if ((size_t)domain >= byDomain.size() || IsNan(byDomain[domain].mua) || IsNan(byDomain[domain].mus))
+            {
+                throw std::runtime_error("重放没有给出域" + std::to_string(domain) + "的μa和μs");
+            }
+            const Attribute &a     = byDomain[domain];
+            functor.mus[s]         = a.mus;
+            functor.dMut[s]        = (a.mua + a.mus) - ref.mut;
+            functor.logMusRatio[s] = a.mus > 0 && ref.mus > 0 ? (Accum)std::log((Accum)a.mus / (Accum)ref.mus) : 0;
+            functor.killed[s]      = a.mus <= 0 && ref.mus > 0;
+        }
+        ReplayResult result;
+        result.numBins = m_numBins;
+        std::vector<Accum> values(functor.value_count, 0);
+        Kokkos::View<Accum *, Kokkos::HostSpace, Kokkos::MemoryTraits<Kokkos::Unmanaged>> values_h(values.data(),
+                                                                                                   values.size());
+        Kokkos::parallel_reduce("replay_reweight", Kokkos::RangePolicy<ExecSpace>(0, m_count), functor, values_h);
+        const size_t n = (size_t)m_numBins * MAX_PATH_DOMAINS;
+        result.signal.assign(values.begin(), values.begin() + m_numBins);
+        result.dMua.assign(values.begin() + m_numBins, values.begin() + m_numBins + n);
+        result.dMus.assign(values.begin() + m_numBins + n, values.end());
+        return result;
+    }
+
+   private:
+    int m_numBins = 0;
+    Kokkos::View<Detector *, ExecSpace> m_detectors;
+    Material m_reference[MAX_PATH_DOMAINS];  // 记录时各域的属性
+    Kokkos::View<DetectedPhoton *, ExecSpace> m_photons;
+    size_t m_count = 0;
+
+    // 数组归约: [信号(numBins) | ∂/∂μa(numBins × 域) | ∂/∂μs(numBins × 域)]
+    typedef struct ReplayFunctor
+    {
+        using value_type = Accum[];
+        unsigned value_count = 0;
+        int numBins          = 0;
+        Kokkos::View<DetectedPhoton *, ExecSpace> photons;
+        Scalar mus[MAX_PATH_DOMAINS]        = {};
+        Scalar dMut[MAX_PATH_DOMAINS]       = {};
+        Accum logMusRatio[MAX_PATH_DOMAINS] = {};
+        bool killed[MAX_PATH_DOMAINS]       = {};  // 新的μs为0, 有散射的路径权重为0
+
+        KOKKOS_INLINE_FUNCTION
+        void operator()(const size_t i, value_type values) const
+        {
+            const DetectedPhoton &p = photons(i);
+            Accum exponent          = 0;
+            for (int s = 0; s < MAX_PATH_DOMAINS; s++)
+            {
+                if (killed[s] && p.scatters[s] > 0) return;
+                exponent += logMusRatio[s] * (Accum)p.scatters[s] - (Accum)dMut[s] * (Accum)p.path[s];
+            }
+            const Accum w = p.weight * Kokkos::exp(exponent);
+            values[p.bin] += w;
+            Accum *dMua = values + numBins + p.bin * MAX_PATH_DOMAINS;
+            Accum *dMus = dMua + numBins * MAX_PATH_DOMAINS;
+            for (int s = 0; s < MAX_PATH_DOMAINS; s++)
+            {
+                dMua[s] -= (Accum)p.path[s] * w;
+                if (mus[s] > 0) dMus[s] += ((Accum)p.scatters[s] / (Accum)mus[s] - (Accum)p.path[s]) * w;
+            }
+        }
+        KOKKOS_INLINE_FUNCTION
+        void init(value_type values) const
+        {
+            for (unsigned k = 0; k < value_count; k++) values[k] = 0;
+        }
+        KOKKOS_INLINE_FUNCTION
+        void join(value_type dst, const value_type src) const
+        {
+            for (unsigned k = 0; k < value_count; k++) dst[k] += src[k];
+        }
+    } ReplayFunctor;
+};
+#endif
@@ -1,21 +1,289 @@
 #ifndef RUN_H
 #define RUN_H
-#include "Kokkos_Assert.hpp"
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <vector>
+#include <Kokkos_Profiling_ScopedRegion.hpp>
+#include "Detector.h"
+#include "Replay.h"
+#include "Source.h"
 #include "Transpose_core.h"
+#include "Wavefront.h"
+
+// 传输引擎: MEGAKERNEL 每个线程跑完一个光子的全部过程, WAVEFRONT 按阶段分kernel并按四面体排序光子
+enum class Engine
+{
+    MEGAKERNEL,
+    WAVEFRONT
+};
+// 批量运行的汇总计数, 每批在设备上归约后累加
+typedef struct RunTally
+{
+    uint64_t photons        = 0;
+    uint64_t collected      = 0;
+    uint64_t outOfRange     = 0;
+    uint64_t ignored        = 0;
+    Accum collectedWeight   = 0;
+    Accum outOfRangeWeight  = 0;
+    KOKKOS_INLINE_FUNCTION
+    RunTally& operator+=(const RunTally& o)
+    {
+        photons += o.photons;
+        collected += o.collected;
+        outOfRange += o.outOfRange;
+        ignored += o.ignored;
+        collectedWeight += o.collectedWeight;
+        outOfRangeWeight += o.outOfRangeWeight;
+        return *this;
+    }
+} RunTally;
+namespace Kokkos
+{
+template <>
+struct reduction_identity<RunTally>
+{
+    KOKKOS_FORCEINLINE_FUNCTION static RunTally sum() { return RunTally(); }
+};
+}  // namespace Kokkos
+// 光谱模式下每组的出射统计, 各次run/run_batched累加; 每组的吸收统计见SpectralSets::absorbed
+typedef struct SpectralTally
+{
+    std::vector<Accum> collectedWeight;   // 每组被收集的权重
+    std::vector<Accum> outOfRangeWeight;  // 每组从边界离开的权重
+    std::vector<DetectorSet> detectors;   // 每组一份探测器直方图
+} SpectralTally;
+// 流式输出的单条记录: 全局光子编号 + 结果
+typedef struct PhotonRecord
+{
+    uint64_t photon = 0;
+    resultType result;
+} PhotonRecord;
+// 每批结束时以该批中非IGNORE的记录调用一次
+using RecordSink = std::function<void(const Kokkos::View<const PhotonRecord*, Kokkos::HostSpace>&)>;
 
 class Run
 {
    public:
-    Run(const char* mesh_path) : m_mesh_path(mesh_path), m_mesh(mesh_path) {}
-    Kokkos::View<resultType*, Kokkos::HostSpace> run(unsigned int num_photons)
+    Run(const char* mesh_path)
+        : m_mesh_path(mesh_path), m_mesh(mesh_path), m_collect(m_mesh), m_seed((uint64_t)time(NULL))
+    {
+    }
+    // source为单个Photon3D(所有光子相同)或SourceSampler抽样的逐光子Photon3D数组; spectral非空时为光谱模式.
+    // 返回本次传输的热路径计数, 未定义MC_INSTRUMENT时全为0
+    template <class Collect, class ResultView, class SourceT>
+    static TransportCounters Transport(const TetMesh& mesh, const Collect& strategy, uint64_t seed,
+                                       const AbsorptionTally& tally, const ResultView& results,
+                                       const SourceT& source, Engine engine, bool log = false,
+                                       const TransportOptions& options = TransportOptions(), uint64_t firstPhoton = 0,
+                                       const SpectralSets& spectral = SpectralSets())
+    {
+        Kokkos::Profiling::ScopedRegion region("Run::Transport");
+        if (engine == Engine::WAVEFRONT)
+        {
+            WavefrontEngine<Collect> wavefront(mesh, strategy, seed, tally);
+            wavefront.options  = options;
+            wavefront.spectral = spectral;
+            wavefront.run(results, source, log, firstPhoton);
+            return wavefront.counters;
+        }
+        if (log)
+        {
+            return Megakernel<TraceLevel::PHOTON>(mesh, strategy, seed, tally, results, source, options, firstPhoton,
+                                                  spectral);
+        }
+        return Megakernel<TraceLevel::NONE>(mesh, strategy, seed, tally, results, source, options, firstPhoton,
+                                            spectral);
+    }
+    template <TraceLevel trace = TraceLevel::NONE, class Collect, class ResultView, class SourceT>
+    static TransportCounters Megakernel(const TetMesh& mesh, const Collect& strategy, uint64_t seed,
+                                        const AbsorptionTally& tally, const ResultView& results,
+                                        const SourceT& source, const TransportOptions& options = TransportOptions(),
+                                        uint64_t firstPhoton = 0, const SpectralSets& spectral = SpectralSets())
+    {
+        TransportCounters counters;
+        CountedFor(
+            "run", Kokkos::RangePolicy<ExecSpace>(0, results.extent(0)),
+            KOKKOS_LAMBDA(const unsigned int i, Counters& localCounters)
+            {
+                transpose_core<trace, Collect> core(mesh, strategy, PhiloxRandom(seed, firstPhoton + i));
+                core.set_tally(tally);
+                core.set_options(options);
+                core.set_spectral(spectral);
+                core.m_photon = StartPhoton(source, i);
+                core.run();
+                results(i) = core.result;
+                localCounters += core.counters;
+            },
+            counters);
+        return counters;
+    }
+    Kokkos::View<resultType*, Kokkos::HostSpace> run(unsigned int num_photons, Engine engine = Engine::MEGAKERNEL,
+                                                     const Photon3D& source = Photon3D())
+    {
+        Kokkos::Profiling::ScopedRegion region("Run::run");
+        return RunImpl(num_photons, engine, source, source.pos);
+    }
+    // 从光源source抽样每个光子的初始位置、方向和起始四面体
+    Kokkos::View<resultType*, Kokkos::HostSpace> run(unsigned int num_photons, Engine engine, const Source& source)
+    {
+        Kokkos::Profiling::ScopedRegion region("Run::run");
+        Kokkos::View<Photon3D*, ExecSpace> starts("starts", num_photons);
+        Sampler(source).Sample(m_mesh, m_seed, m_nextPhoton, starts);
+        return RunImpl(num_photons, engine, starts, source.pos);
+    }
+    // 分批运行, 设备和host缓冲只按batch_size分配并在各批间复用, 内存占用与num_photons无关.
+    // 每批归约为RunTally; sink非空时把该批非IGNORE的记录压缩后拷回host交给sink.
+    RunTally run_batched(uint64_t num_photons, size_t batch_size, const RecordSink& sink = nullptr,
+                         Engine engine = Engine::MEGAKERNEL, const Photon3D& source = Photon3D())
+    {
+        Kokkos::Profiling::ScopedRegion region("Run::run_batched");
+        return RunBatchedImpl(num_photons, batch_size, sink, engine, source.pos,
+                              [&](uint64_t, size_t) { return source; });
+    }
+    // 每批先从光源source抽样该批光子的初始状态
+    RunTally run_batched(uint64_t num_photons, size_t batch_size, const RecordSink& sink, Engine engine,
+                         const Source& source)
+    {
+        Kokkos::Profiling::ScopedRegion region("Run::run_batched");
+        const SourceSampler& sampler = Sampler(source);
+        Kokkos::View<Photon3D*, ExecSpace> starts("starts", (size_t)std::min<uint64_t>(batch_size, num_photons));
+        return RunBatchedImpl(num_photons, batch_size, sink, engine, source.pos,
+                              [&](uint64_t first, size_t count)
+                              {
+                                  auto batch = Kokkos::subview(starts, Kokkos::make_pair((size_t)0, count));
+                                  sampler.Sample(m_mesh, m_seed, first, batch);
+                                  return batch;
+                              });
+    }
+    // 开启按四面体的吸收统计, 之后的run/run_batched都会累加到同一个统计中
+    void EnableAbsorptionTally(AbsorptionTally::Mode mode = AbsorptionTally::Mode::AUTO)
+    {
+        m_absorption.Init(m_mesh, mode);
+    }
+    AbsorptionTally& Absorption() { return m_absorption; }
+    // 设置探测器, 之后的run/run_batched在每批结束后把出射光子计入探测器直方图;
+    // 所有探测器都给出时间窗时, 时间门取最晚的时间窗终点与SetTimeGate给出的时间门中较早的一个
+    void SetDetectors(const std::vector<Detector>& detectors)
+    {
+        m_detectors        = DetectorSet(detectors);
+        m_options.timeGate = Kokkos::fmin(m_timeGate, m_detectors.TimeGate());
+        if (m_spectral.Enabled()) ResetSpectralTally();
+        RestartReplay();
+    }
+    // 光谱模式: sets[k]为第k组按域编号给出的属性(如第k个波长), 各组只允许μa不同, 网格的材料设为sets[0].
+    // 之后的run/run_batched一次传输得到每组的出射权重、探测器直方图, tallyAbsorption为true时还有每组按四面体的吸收;
+    // 原有的吸收统计和探测器直方图不再累加, RunTally和结果中的weight为不含吸收的行走权重. sets为空时关闭光谱模式;
+    // 之后调用SetMaterials/LoadMaterials也会关闭光谱模式, 需要时以新材料重新调用SetPropertySets
+    void SetPropertySets(const std::vector<std::vector<Attribute>>& sets, bool tallyAbsorption = false)
+    {
+        if (sets.empty())
+        {
+            DisableSpectral();
+            return;
+        }
+        m_mesh.SetMaterials(sets[0]);
+        m_spectral = SpectralSets(m_mesh, sets, tallyAbsorption);
+        ResetSpectralTally();
+        RestartReplay();
+    }
+    const SpectralSets& PropertySets() const { return m_spectral; }
+    const SpectralTally& Spectral() const { return m_spectralTally; }
+    // 拷回host的结果r在第set组的权重
+    Accum WeightOf(const resultType& r, int set) const { return r.weight * m_spectral.HostAttenuation(set, r.path); }
+    // 第i个光子的随机数流由(seed, 全局编号)决定, 相同的种子和编号在任何后端和线程数下结果相同.
+    // 每次run/run_batched从上一次结束的编号继续, 不会重复使用随机数流
+    void SetSeed(uint64_t seed, uint64_t firstPhoton = 0)
+    {
+        m_seed       = seed;
+        m_nextPhoton = firstPhoton;
+    }
+    // 飞行时间(ns)超过timeGate的光子直接终止, 不再参与出射和吸收统计; REALMAX表示不限制.
+    // 与探测器的时间窗分开保存, 实际使用二者中较早的一个, 之后再设置探测器也不会放宽
+    void SetTimeGate(Scalar timeGate)
+    {
+        m_timeGate         = timeGate;
+        m_options.timeGate = Kokkos::fmin(m_timeGate, m_detectors.TimeGate());
+    }
+    // 按NETGEN域编号设置材料, 覆盖网格同名.mat文件中的设置.
+    // 光谱模式的各组μa是按原材料给出的, 与新材料不再对应, 因此同时关闭光谱模式(见SetPropertySets)
+    void SetMaterials(const std::vector<Attribute>& byDomain)
+    {
+        m_mesh.SetMaterials(byDomain);
+        DisableSpectral();
+        RestartReplay();
+    }
+    void LoadMaterials(const std::string& path)
+    {
+        m_mesh.LoadMaterials(path);
+        DisableSpectral();
+        RestartReplay();
+    }
+    // 微扰/重放: 之后的run/run_batched记录每个被探测器计入的光子的各域路径长度、散射次数和随机数流(见Replay.h),
+    // 之后用Replay().Reweight(新属性)不再传输光子即可得到新μa/μs下的探测器信号和雅可比矩阵.
+    // 需要先设置探测器; 探测器或材料改变时缓冲清空, 以新的材料为原参数
+    void EnableReplay(bool enable = true)
+    {
+        m_replay              = enable ? ReplayBuffer(m_mesh, m_detectors) : ReplayBuffer();
+        m_options.recordPaths = enable;
+    }
+    const ReplayBuffer& Replay() const { return m_replay; }
+    // 界面反射率: EXACT逐次计算, TABLE查表(resolution为每张表的采样间隔数, 改变时重建表)
+    void SetFresnel(FresnelMode mode, int resolution = FresnelTable::DEFAULT_RESOLUTION)
+    {
+        m_options.fresnel = mode;
+        if (mode == FresnelMode::TABLE && resolution != m_mesh.fresnel.resolution) m_mesh.BuildFresnelTable(resolution);
+    }
+    // 自由程和散射方向的抽样: EXACT与原实现一致, FAST用近似函数, 偏差见bench中的统计对比
+    void SetSampling(SamplingMode mode) { m_options.sampling = mode; }
+    const DetectorSet& Detectors() const { return m_detectors; }
+    // 每个四面体的收集标签, 用SetDomain/SetBoundary/SetTets设置后对之后的run/run_batched生效
+    TetLabelCollect& Collect() { return m_collect; }
+    const TetMesh& Mesh() const { return m_mesh; }
+    // 上一次run/run_batched的热路径计数, 只有定义MC_INSTRUMENT编译时才有值
+    const TransportCounters& LastCounters() const { return m_counters; }
+    // 在host上报告错误, 不依赖KOKKOS_ASSERT, 不开启Kokkos debug的构建中同样生效
+    void check_Mesh()
+    {
+        Kokkos::Profiling::ScopedRegion region("Run::check_Mesh");
+        if (m_mesh.NumTets() <= 0) throw std::runtime_error("网格中没有四面体");
+        const TetMesh mesh = m_mesh;
+        Index invalid      = 0;
+        Kokkos::parallel_reduce(
+            "check_Mesh", Kokkos::RangePolicy<ExecSpace>(0, m_mesh.NumTets()),
+            KOKKOS_LAMBDA(const Index i, Index& local)
+            {
+                if (!mesh.GetMaterial(i).Valid()) local++;
+            },
+            invalid);
+        if (invalid > 0) throw std::runtime_error("mesh属性中存在nan值, 有域没有在材料表中设置");
+    }
+
+   private:
+    const char* m_mesh_path;
+    TetMesh m_mesh;
+    TetLabelCollect m_collect;
+    AbsorptionTally m_absorption;
+    DetectorSet m_detectors;
+    TransportOptions m_options;
+    Scalar m_timeGate = REALMAX;  // SetTimeGate给出的时间门, m_options.timeGate还受探测器时间窗限制
+    TransportCounters m_counters;
+    SourceSampler m_sampler;  // 上一次使用的光源及其预处理结果
+    bool m_hasSampler = false;
+    SpectralSets m_spectral;  // 光谱模式的各组μa, 未设置时为空
+    SpectralTally m_spectralTally;
+    ReplayBuffer m_replay;  // 开启重放时被探测的光子
+    uint64_t m_seed       = 0;
+    uint64_t m_nextPhoton = 0;  // 下一个光子的全局编号
+
+    template <class SourceT>
+    Kokkos::View<resultType*, Kokkos::HostSpace> RunImpl(unsigned int num_photons, Engine engine,
+                                                         const SourceT& source, const Point& center)
     {
         check_Mesh();
         Kokkos::View<resultType*, ExecSpace, Kokkos::MemoryTraits<Kokkos::RandomAccess>> results("results",
                                                                                                  num_photons);
-        auto rand_pool = RandPoolType(time(NULL));
-        Kokkos::UnorderedMap<Index, CollectType, ExecSpace> collect_map(m_mesh.pyramids.extent(0));
-        auto strategy = DefaultCollectStrategy(collect_map);
-        bool log      = false;
+        bool log = false;
         if (num_photons == 1)
         {
             log = true;
@@ -24,36 +292,165 @@ class Run
         {
             Kokkos::printf("log is on\n");
         }
-        Kokkos::parallel_for(
-            "run", Kokkos::RangePolicy<ExecSpace>(0, num_photons),
-            KOKKOS_CLASS_LAMBDA(const unsigned int i)
-            {
-                transpose_core core(m_mesh, strategy, rand_pool);
-                core.run(log);
-                results(i) = core.result;
-            });
+        m_absorption.SetHotRegion(m_mesh, center, AbsorptionTally::DEFAULT_HOT_TETS);
+        m_counters = Transport(m_mesh, m_collect, m_seed, m_absorption, results, source, engine, log, m_options,
+                               m_nextPhoton, m_spectral);
+        if constexpr (INSTRUMENT) m_counters.Print();
+        if (m_spectral.Enabled())
+            AccumulateSpectral(results);
+        else
+            m_detectors.Accumulate(m_mesh, results);
+        CaptureReplay(results, m_nextPhoton);
+        m_nextPhoton += num_photons;
         Kokkos::View<resultType*, Kokkos::HostSpace> host_results("results", num_photons);
         Kokkos::deep_copy(host_results, results);
         return host_results;
-    };
-    void check_Mesh()
+    }
+    // prepare(全局编号, 个数)返回该批光子的初始状态(单个Photon3D或Photon3D数组)
+    template <class Prepare>
+    RunTally RunBatchedImpl(uint64_t num_photons, size_t batch_size, const RecordSink& sink, Engine engine,
+                            const Point& center, const Prepare& prepare)
     {
-#if defined(NDEBUG) and not defined(KOKKOS_ENABLE_DEBUG)
-        Kokkos::abort("KOKKOS_ASSERT NOT DEFINED!!!");
-#endif
+        check_Mesh();
+        m_counters = TransportCounters();
+        batch_size = (size_t)std::min<uint64_t>(batch_size, num_photons);
+        RunTally total;
+        if (batch_size == 0) return total;
+        const uint64_t firstPhoton = m_nextPhoton;
+        m_nextPhoton += num_photons;
+        Kokkos::View<resultType*, ExecSpace> results("results", batch_size);
+        Kokkos::View<PhotonRecord*, ExecSpace> records;
+        Kokkos::View<PhotonRecord*, Kokkos::HostSpace> host_records;
+        if (sink)
+        {
+            records      = Kokkos::View<PhotonRecord*, ExecSpace>("records", batch_size);
+            host_records = Kokkos::View<PhotonRecord*, Kokkos::HostSpace>("host_records", batch_size);
+        }
+        m_absorption.SetHotRegion(m_mesh, center, AbsorptionTally::DEFAULT_HOT_TETS);
+        WavefrontEngine<TetLabelCollect> wavefront(m_mesh, m_collect, m_seed, m_absorption);
+        wavefront.options  = m_options;
+        wavefront.spectral = m_spectral;
 
-        KOKKOS_ASSERT(m_mesh.pyramids.extent(0) > 0);
-        auto policy = Kokkos::RangePolicy<>(0, m_mesh.pyramids.extent(0));
-        Kokkos::parallel_for(
-            "check_Mesh", policy, KOKKOS_CLASS_LAMBDA(const int i) {
-                KOKKOS_ASSERT(!IsNan(m_mesh.pyramids(i).value.mua) && !IsNan(m_mesh.pyramids(i).value.mus) &&
-                              !IsNan(m_mesh.pyramids(i).value.g) && !IsNan(m_mesh.pyramids(i).value.n) &&
-                              "mesh属性中存在nan值");
-            });
-    }
+        for (uint64_t first = 0; first < num_photons; first += batch_size)
+        {
+            const size_t count = (size_t)std::min<uint64_t>(batch_size, num_photons - first);
+            auto batch         = Kokkos::subview(results, Kokkos::make_pair((size_t)0, count));
+            const auto source  = prepare(firstPhoton + first, count);
+            if (engine == Engine::WAVEFRONT)
+                wavefront.run(batch, source, false, firstPhoton + first);
+            else
+                m_counters += Megakernel(m_mesh, m_collect, m_seed, m_absorption, batch, source, m_options,
+                                         firstPhoton + first, m_spectral);
 
-   private:
-    const char* m_mesh_path;
-    TetMesh m_mesh;
+            RunTally tally;
+            Kokkos::parallel_reduce(
+                "run_batched_tally", Kokkos::RangePolicy<ExecSpace>(0, count),
+                KOKKOS_LAMBDA(const size_t i, RunTally& local)
+                {
+                    const resultType& r = batch(i);
+                    local.photons++;
+                    if (r.type == CollectType::COLLECT)
+                    {
+                        local.collected++;
+                        local.collectedWeight += r.weight;
+                    }
+                    else if (r.type == CollectType::OUTOFRANGE)
+                    {
+                        local.outOfRange++;
+                        local.outOfRangeWeight += r.weight;
+                    }
+                    else
+                    {
+                        local.ignored++;
+                    }
+                },
+                Kokkos::Sum<RunTally>(tally));
+            total += tally;
+            if (m_spectral.Enabled())
+                AccumulateSpectral(batch);
+            else
+                m_detectors.Accumulate(m_mesh, batch);
+            CaptureReplay(batch, firstPhoton + first);
+            if (!sink) continue;
+
+            size_t kept = 0;
+            Kokkos::parallel_scan(
+                "run_batched_compact", Kokkos::RangePolicy<ExecSpace>(0, count),
+                KOKKOS_LAMBDA(const size_t i, size_t& offset, const bool final)
+                {
+                    if (batch(i).type == CollectType::IGNORE) return;
+                    if (final) records(offset) = PhotonRecord{firstPhoton + first + i, batch(i)};
+                    offset++;
+                },
+                kept);
+            auto kept_range = Kokkos::make_pair((size_t)0, kept);
+            Kokkos::deep_copy(Kokkos::subview(host_records, kept_range), Kokkos::subview(records, kept_range));
+            sink(Kokkos::subview(host_records, kept_range));
+        }
+        m_counters += wavefront.counters;
+        if constexpr (INSTRUMENT) m_counters.Print();
+        return total;
+    }
+    void DisableSpectral()
+    {
+        m_spectral      = SpectralSets();
+        m_spectralTally = SpectralTally();
+    }
+    void ResetSpectralTally()
+    {
+        m_spectral.Reset();
+        m_spectralTally.collectedWeight.assign(m_spectral.numSets, 0);
+        m_spectralTally.outOfRangeWeight.assign(m_spectral.numSets, 0);
+        m_spectralTally.detectors.clear();
+        for (int k = 0; k < m_spectral.numSets; k++) m_spectralTally.detectors.push_back(m_detectors.Clone());
+    }
+    void RestartReplay()
+    {
+        if (m_replay.Enabled()) m_replay = ReplayBuffer(m_mesh, m_detectors);
+    }
+    // 把一批结果中被探测的光子追加到重放缓冲, 光谱模式以第0组为原参数
+    template <class ResultView>
+    void CaptureReplay(const ResultView& results, uint64_t firstPhoton)
+    {
+        if (!m_replay.Enabled()) return;
+        if (m_spectral.Enabled())
+            m_replay.Capture(m_mesh, results, m_seed, firstPhoton, SetWeight{m_spectral, 0});
+        else
+            m_replay.Capture(m_mesh, results, m_seed, firstPhoton, DetectorSet::ResultWeight());
+    }
+    // 逐组把一批结果按该组的权重计入出射统计和探测器直方图
+    template <class ResultView>
+    void AccumulateSpectral(const ResultView& results)
+    {
+        for (int k = 0; k < m_spectral.numSets; k++)
+        {
+            const SetWeight weight{m_spectral, k};
+            Accum collected = 0, outOfRange = 0;
+            Kokkos::parallel_reduce(
+                "spectral_tally", Kokkos::RangePolicy<ExecSpace>(0, results.extent(0)),
+                KOKKOS_LAMBDA(const size_t i, Accum& localCollected, Accum& localOutOfRange)
+                {
+                    const resultType& r = results(i);
+                    if (r.type == CollectType::COLLECT)
+                        localCollected += weight(r);
+                    else if (r.type == CollectType::OUTOFRANGE)
+                        localOutOfRange += weight(r);
+                },
+                Kokkos::Sum<Accum>(collected), Kokkos::Sum<Accum>(outOfRange));
+            m_spectralTally.collectedWeight[k] += collected;
+            m_spectralTally.outOfRangeWeight[k] += outOfRange;
+            m_spectralTally.detectors[k].Accumulate(m_mesh, results, weight);
+        }
+    }
+    // 同一光源在多次run/run_batched之间只预处理一次
+    const SourceSampler& Sampler(const Source& source)
+    {
+        if (!m_hasSampler || !(m_sampler.source == source))
+        {
+            m_sampler    = SourceSampler(m_mesh, source);
+            m_hasSampler = true;
+        }
+        return m_sampler;
+    }
 };
 #endif
\ No newline at end of file
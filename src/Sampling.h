@@ -0,0 +1,67 @@
+#ifndef SAMPLING_H
+#define SAMPLING_H
+#include <cstdint>
+#include "Utils.h"
+
+// 自由程和散射方向的抽样方式, 每次运行可选
+enum class SamplingMode
+{
+    EXACT,  // libm的log/pow/sin/cos, 与原实现逐位一致
+    FAST    // 多项式近似的log和sincos, 有理形式的HG反函数, 无分支的方向旋转; 有界的小偏差换吞吐量
+};
+
+// FAST抽样用到的近似函数. 多项式系数按区间上的最大误差拟合, 误差均为绝对误差.
+// Log和SinCos2Pi直接操作float的位表示, Scalar为double时也按float计算, 误差界不变
+class FastMath
+{
+   public:
+    // ln(x), x为正的正规数; 误差 < 2e-6 (多项式误差4e-7, 其余为float舍入)
+    KOKKOS_INLINE_FUNCTION
+    static float Log(float x)
+    {
+        const uint32_t bits = Kokkos::bit_cast<uint32_t>(x);
+        int e               = (int)(bits >> 23) - 127;
+        float m             = Kokkos::bit_cast<float>((bits & 0x007FFFFFu) | 0x3F800000u);  // x = m * 2^e, m∈[1, 2)
+        // 把m移到[sqrt(1/2), sqrt(2)), ln(1 + f)在0附近展开
+        const bool high = m > 1.41421356f;
+        m               = high ? 0.5f * m : m;
+        e               = high ? e + 1 : e;
+        const float f   = m - 1;
+        const float f2  = f * f;
+        const float p =
+            0.333174295f + f * (-0.249368689f + f * (0.204938731f + f * (-0.184968813f + f * 0.117076988f)));
+        return f - 0.5f * f2 + f2 * f * p + (float)e * 0.693147181f;
+    }
+    // sin(2πxi)和cos(2πxi), xi∈[0, 1]; 误差 < 2e-7
+    KOKKOS_INLINE_FUNCTION
+    static void SinCos2Pi(float xi, float *s, float *c)
+    {
+        // 2πxi = qπ/2 + a, a∈[-π/4, π/4]
+        const float u  = 4 * xi;
+        const int q    = (int)(u + 0.5f);
+        const float a  = (u - (float)q) * 1.57079633f;
+        const float a2 = a * a;
+        const float sa = a + a * a2 * (-0.166666507f + a2 * (0.00833197860f + a2 * -0.000194956299f));
+        const float ca = 1 - 0.5f * a2 + a2 * a2 * (0.0416612783f + a2 * -0.00136524446f);
+        // 按象限交换并取符号
+        const bool odd = q & 1;
+        *s             = (q & 2) ? -(odd ? ca : sa) : (odd ? ca : sa);
+        *c             = ((q + 1) & 2) ? -(odd ? sa : ca) : (odd ? sa : ca);
+    }
+    // 把单位向量d偏转到与d夹角为θ、方位角为φ的方向.
+    // 以d为z轴的正交基按 Duff et al., "Building an Orthonormal Basis, Revisited" (JCGT 2017) 构造,
+    // 只有一次除法, 不需要对|dz|接近1的情况单独处理; float下结果的长度与1相差 < 3e-7
+    KOKKOS_INLINE_FUNCTION
+    static Vec3f Rotate(const Vec3f &d, Scalar cosTheta, Scalar sinTheta, Scalar cosPhi, Scalar sinPhi)
+    {
+        const Scalar sign = Kokkos::copysign((Scalar)1, d.z);
+        const Scalar a    = -1 / (sign + d.z);
+        const Scalar b    = d.x * d.y * a;
+        const Scalar u    = sinTheta * cosPhi;
+        const Scalar v    = sinTheta * sinPhi;
+        return Vec3f{u * (1 + sign * d.x * d.x * a) + v * b + cosTheta * d.x,
+                     u * sign * b + v * (sign + d.y * d.y * a) + cosTheta * d.y,
+                     -u * sign * d.x - v * d.y + cosTheta * d.z};
+    }
+};
+#endif
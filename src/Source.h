@@ -0,0 +1,368 @@
+#ifndef SOURCE_H
+#define SOURCE_H
+#include <stdexcept>
+#include <vector>
+#include "Transpose_core.h"
+
+// 光源类型
+enum class SourceType
+{
+    PENCIL,     // 笔形束: 固定的位置和方向
+    GAUSSIAN,   // 高斯光束: 截面光强 ∝ exp(-2r²/w²), w为1/e²半径, 方向与光轴平行
+    DISK,       // 均匀圆盘光束: 半径内均匀分布, 方向与光轴平行
+    ISOTROPIC,  // 各向同性点光源
+    PLANAR      // 平行四边形区域内均匀分布的准直光, 区域为 pos + a*u + b*v, a, b∈[0, 1]
+};
+
+// 光源描述, 只含POD数据, 按值传入kernel. 用Pencil/Gaussian/Disk/Isotropic/Planar构造
+typedef struct Source
+{
+    SourceType type = SourceType::PENCIL;
+    Point pos{0, 0, 0};  // 位置; GAUSSIAN/DISK为光斑中心, PLANAR为区域的一个角
+    Vec3f dir{0, 0, 1};  // 发射方向(单位向量), ISOTROPIC不使用
+    Scalar radius = 0;   // GAUSSIAN: 1/e²半径; DISK: 半径
+    Vec3f u{0, 0, 0};    // PLANAR: 区域的两条边
+    Vec3f v{0, 0, 0};
+
+    static Source Pencil(const Point &pos, const Vec3f &dir) { return Make(SourceType::PENCIL, pos, dir); }
+    static Source Gaussian(const Point &pos, const Vec3f &dir, Scalar waist)
+    {
+        Source source = Make(SourceType::GAUSSIAN, pos, dir);
+        if (!(waist > 0)) throw std::runtime_error("高斯光束的1/e²半径必须为正");
+        source.radius = waist;
+        return source;
+    }
+    static Source Disk(const Point &pos, const Vec3f &dir, Scalar radius)
+    {
+        Source source = Make(SourceType::DISK, pos, dir);
+        if (!(radius > 0)) throw std::runtime_error("圆盘光源的半径必须为正");
+        source.radius = radius;
+        return source;
+    }
+    static Source Isotropic(const Point &pos) { return Make(SourceType::ISOTROPIC, pos, Vec3f{0, 0, 1}); }
+    static Source Planar(const Point &corner, const Vec3f &u, const Vec3f &v, const Vec3f &dir)
+    {
+        Source source = Make(SourceType::PLANAR, corner, dir);
+        if (u.cross(v).norm() <= 0) throw std::runtime_error("平面光源的两条边不能平行或为零");
+        source.u = u;
+        source.v = v;
+        return source;
+    }
+    bool operator==(const Source &o) const
+    {
+        return type == o.type && pos == o.pos && dir == o.dir && radius == o.radius && u == o.u && v == o.v;
+    }
+    // 抽样一个光子的位置和方向
+    KOKKOS_INLINE_FUNCTION
+    void Sample(PhiloxRandom &random, Point *p, Vec3f *d) const
+    {
+        *p = pos;
+        *d = dir;
+        switch (type)
+        {
+            case SourceType::PENCIL: break;
+            case SourceType::GAUSSIAN:
+            case SourceType::DISK:
+            {
+                // 径向: 高斯按 P(r) = 1 - exp(-2r²/w²) 反演, 圆盘按面积均匀 r = R√ξ
+                const Scalar xi  = random.Uniform();
+                const Scalar r   = type == SourceType::GAUSSIAN ? radius * Kokkos::sqrt(-Kokkos::log(xi) / 2)
+                                                                : radius * Kokkos::sqrt(xi);
+                const Scalar phi = 2 * Kokkos::numbers::pi_v<Scalar> * random.Uniform();
+                *p               = pos + FastMath::Rotate(dir, 0, 1, Kokkos::cos(phi), Kokkos::sin(phi)) * r;
+                break;
+            }
+            case SourceType::ISOTROPIC:
+            {
+                const Scalar cost = 2 * random.Uniform() - 1;
+                const Scalar sint = Kokkos::sqrt(1 - cost * cost);
+                const Scalar phi  = 2 * Kokkos::numbers::pi_v<Scalar> * random.Uniform();
+                *d                = Vec3f{sint * Kokkos::cos(phi), sint * Kokkos::sin(phi), cost};
+                break;
+            }
+            case SourceType::PLANAR:
+            {
+                const Scalar a = random.Uniform();
+                const Scalar b = random.Uniform();
+                *p             = pos + u * a + v * b;
+                break;
+            }
+        }
+    }
+
+   private:
+    static Source Make(SourceType type, const Point &pos, const Vec3f &dir)
+    {
+        const Scalar length = dir.norm();
+        if (!(length > 0)) throw std::runtime_error("光源方向不能为零向量");
+        Source source;
+        source.type = type;
+        source.pos  = pos;
+        source.dir  = dir / length;
+        return source;
+    }
+} Source;
+
+// 按批抽样光源并解析每个光子的起始四面体, 结果为传输引擎可以直接使用的Photon3D数组(curPyramid已设置),
+// transpose_core::Emit不再需要查空间索引.
+// 构造时在host上做一次预处理: 点光源的起点(或入射点)只解析一次; 有限区域的光源预先找出区域内的候选四面体
+// 和光束可能射入的候选边界面, 不超过MAX_CANDIDATES个时逐个光子只在候选中查找, 区域外的光子(高斯光束的尾部)
+// 和候选过多时退回BVH查询. 准直光束的方向都相同, 候选边界面预先投影到垂直于光轴的平面上,
+// 逐个光子只需做二维的点在三角形内判断.
+class SourceSampler
+{
+   public:
+    // 投影到光轴平面(e1, e2)上的候选边界面
+    typedef struct BeamFace
+    {
+        Index tet = -1;
+        Scalar a[3], b[3];  // 三个顶点的投影坐标
+        Vec3f normal;       // 面的外法向和平面方程 normal·x = offset
+        Scalar offset = 0;
+    } BeamFace;
+
+    // 光源抽样使用随机数流中从该位置开始的一段, 与传输使用的段[0, 2^62)不重叠,
+    // 笔形束不取随机数, 其余光源也不改变传输的随机数序列
+    static constexpr uint64_t SOURCE_DRAWS = 1ULL << 62;
+    static constexpr int MAX_CANDIDATES    = 64;
+    static constexpr Scalar GAUSSIAN_EXTENT = 3;  // 候选区域覆盖的高斯光束半径, 以w为单位; 之外的概率为e^-18
+
+    Source source;
+
+    SourceSampler() = default;
+    SourceSampler(const TetMesh &mesh, const Source &source_) : source(source_)
+    {
+        if (source.type == SourceType::PENCIL || source.type == SourceType::ISOTROPIC)
+            ResolvePoint(mesh);
+        else
+            FindCandidates(mesh);
+    }
+    // 抽样第firstPhoton + i个光子的初始状态写入photons(i); 不与网格相交的光子alive为false
+    template <class PhotonView>
+    void Sample(const TetMesh &mesh, uint64_t seed, uint64_t firstPhoton, const PhotonView &photons) const
+    {
+        const SourceSampler sampler = *this;
+        Kokkos::parallel_for(
+            "source_sample", Kokkos::RangePolicy<ExecSpace>(0, photons.extent(0)),
+            KOKKOS_LAMBDA(const size_t i)
+            {
+                PhiloxRandom random(seed, firstPhoton + i, SOURCE_DRAWS);
+                Photon3D photon;
+                sampler.source.Sample(random, &photon.pos, &photon.dir);
+                sampler.Resolve(mesh, photon);
+                photons(i) = photon;
+            });
+    }
+    // 候选数, 为-1时该类候选未使用(点光源或超过MAX_CANDIDATES)
+    int NumCandidateTets() const { return m_tetsComplete ? (int)m_candidateTets.extent(0) : -1; }
+    int NumCandidateFaces() const { return m_facesComplete ? (int)m_candidateFaces.extent(0) : -1; }
+
+   private:
+    // 点光源: 起点所在的四面体, 或起点在网格外时笔形束射入的四面体和入射点; 各向同性光源在网格外时为-1
+    Index m_startTet = -1;
+    Point m_startPos{0, 0, 0};
+    // 有限区域光源: 区域在垂直于光轴的平面上的投影范围(以e1, e2为轴)
+    Vec3f m_e1{1, 0, 0}, m_e2{0, 1, 0};
+    Scalar m_lo1 = 0, m_hi1 = 0, m_lo2 = 0, m_hi2 = 0;
+    bool m_tetsComplete  = false;  // 候选四面体完整: 区域内的点不在候选中即不在网格内
+    bool m_facesComplete = false;  // 候选边界面完整: 区域内的射线不与候选相交即不与网格相交
+    Kokkos::View<Index *, ExecSpace> m_candidateTets;
+    Kokkos::View<BeamFace *, ExecSpace> m_candidateFaces;
+
+    void ResolvePoint(const TetMesh &mesh)
+    {
+        Kokkos::View<Index, ExecSpace> tet("source_tet");
+        Kokkos::View<Point, ExecSpace> entry("source_entry");
+        const Source source_ = source;
+        Kokkos::parallel_for(
+            "source_resolve", Kokkos::RangePolicy<ExecSpace>(0, 1),
+            KOKKOS_LAMBDA(const int)
+            {
+                Index found = mesh.LocateTet(source_.pos);
+                Point p     = source_.pos;
+                if (found < 0 && source_.type == SourceType::PENCIL)
+                {
+                    Scalar t = 0;
+                    found    = mesh.FirstBoundaryHit(source_.pos, source_.dir, &t);
+                    p        = source_.pos + source_.dir * t;
+                }
+                tet()   = found;
+                entry() = p;
+            });
+        auto tet_h   = Kokkos::create_mirror_view_and_copy(Kokkos::HostSpace(), tet);
+        auto entry_h = Kokkos::create_mirror_view_and_copy(Kokkos::HostSpace(), entry);
+        m_startTet   = tet_h();
+        m_startPos   = entry_h();
+    }
+    void FindCandidates(const TetMesh &mesh)
+    {
+        m_e1 = FastMath::Rotate(source.dir, 0, 1, 1, 0);
+        m_e2 = FastMath::Rotate(source.dir, 0, 1, 0, 1);
+        // 区域的四个角: 高斯/圆盘为光轴平面上的外接正方形, 平面光源为平行四边形的顶点
+        const Scalar r = source.type == SourceType::GAUSSIAN ? GAUSSIAN_EXTENT * source.radius : source.radius;
+        Point corners[4];
+        if (source.type == SourceType::PLANAR)
+        {
+            corners[0] = source.pos;
+            corners[1] = source.pos + source.u;
+            corners[2] = source.pos + source.v;
+            corners[3] = source.pos + source.u + source.v;
+        }
+        else
+        {
+            for (int k = 0; k < 4; k++) corners[k] = source.pos + m_e1 * (k & 1 ? r : -r) + m_e2 * (k & 2 ? r : -r);
+        }
+        AABB region;
+        m_lo1 = m_lo2 = REALMAX;
+        m_hi1 = m_hi2 = -REALMAX;
+        Scalar front  = REALMAX;  // 区域沿光轴最靠后的位置, 在其之后的边界面才可能被射入
+        for (const Point &c : corners)
+        {
+            region.Expand(c);
+            const Vec3f d = c - source.pos;
+            m_lo1         = Kokkos::fmin(m_lo1, d.dot(m_e1));
+            m_hi1         = Kokkos::fmax(m_hi1, d.dot(m_e1));
+            m_lo2         = Kokkos::fmin(m_lo2, d.dot(m_e2));
+            m_hi2         = Kokkos::fmax(m_hi2, d.dot(m_e2));
+            front         = Kokkos::fmin(front, d.dot(source.dir));
+        }
+
+        auto tets      = Kokkos::create_mirror_view_and_copy(Kokkos::HostSpace(), mesh.tetVertices);
+        auto points    = Kokkos::create_mirror_view_and_copy(Kokkos::HostSpace(), mesh.vertices);
+        auto neighbors = Kokkos::create_mirror_view_and_copy(Kokkos::HostSpace(), mesh.faceNeighbors);
+        auto planes    = Kokkos::create_mirror_view_and_copy(Kokkos::HostSpace(), mesh.tetFaces);
+        std::vector<Index> tetIds;
+        std::vector<BeamFace> faces;
+        for (Index i = 0; i < mesh.NumTets(); i++)
+        {
+            AABB box;
+            for (int k = 0; k < 4; k++) box.Expand(points(tets(i)[k]));
+            const bool overlaps = box.lo.x <= region.hi.x && box.hi.x >= region.lo.x && box.lo.y <= region.hi.y &&
+                                  box.hi.y >= region.lo.y && box.lo.z <= region.hi.z && box.hi.z >= region.lo.z;
+            if (overlaps && tetIds.size() <= MAX_CANDIDATES) tetIds.push_back(i);
+            for (int f = 0; f < 4; f++)
+            {
+                // 光束只能从外法向与光轴相对的边界面射入
+                if (neighbors(i)[f] >= 0 || faces.size() > MAX_CANDIDATES) continue;
+                if (planes(i).normal[f].dot(source.dir) >= 0) continue;
+                // 面在光轴平面上的投影范围与区域的投影范围相交, 且面不完全在区域之后
+                BeamFace face;
+                Scalar ahead = -REALMAX;
+                for (int k = 0; k < 3; k++)
+                {
+                    const Vec3f d = points(tets(i)[TetFaceVertex(f, k)]) - source.pos;
+                    face.a[k]     = d.dot(m_e1);
+                    face.b[k]     = d.dot(m_e2);
+                    ahead         = Kokkos::fmax(ahead, d.dot(source.dir));
+                }
+                const Scalar lo1 = Kokkos::fmin(face.a[0], Kokkos::fmin(face.a[1], face.a[2]));
+                const Scalar hi1 = Kokkos::fmax(face.a[0], Kokkos::fmax(face.a[1], face.a[2]));
+                const Scalar lo2 = Kokkos::fmin(face.b[0], Kokkos::fmin(face.b[1], face.b[2]));
+                const Scalar hi2 = Kokkos::fmax(face.b[0], Kokkos::fmax(face.b[1], face.b[2]));
+                if (lo1 <= m_hi1 && hi1 >= m_lo1 && lo2 <= m_hi2 && hi2 >= m_lo2 && ahead >= front)
+                {
+                    face.tet    = i;
+                    face.normal = planes(i).normal[f];
+                    face.offset = planes(i).d[f];
+                    faces.push_back(face);
+                }
+            }
+        }
+        m_tetsComplete  = tetIds.size() <= MAX_CANDIDATES;
+        m_facesComplete = faces.size() <= MAX_CANDIDATES;
+        if (m_tetsComplete) m_candidateTets = ToDevice(tetIds, "source_candidate_tets");
+        if (m_facesComplete) m_candidateFaces = ToDevice(faces, "source_candidate_faces");
+    }
+    template <class T>
+    static Kokkos::View<T *, ExecSpace> ToDevice(const std::vector<T> &items, const char *label)
+    {
+        Kokkos::View<T *, ExecSpace> view(label, items.size());
+        Kokkos::deep_copy(view, Kokkos::View<const T *, Kokkos::HostSpace, Kokkos::MemoryTraits<Kokkos::Unmanaged>>(
+                                    items.data(), items.size()));
+        return view;
+    }
+    // 区域内的准直光子在候选边界面中找最近的射入点, 返回射入的四面体, *t为距离; 不与候选相交时返回-1
+    KOKKOS_INLINE_FUNCTION
+    Index BeamEntry(const Point &pos, Scalar a, Scalar b, Scalar *t) const
+    {
+        Index tet = -1;
+        *t        = REALMAX;
+        for (size_t k = 0; k < m_candidateFaces.extent(0); k++)
+        {
+            const BeamFace &face = m_candidateFaces(k);
+            // 二维的边函数, 投影三角形的朝向不定, 三个同号(含0)即在三角形内
+            Scalar edge[3];
+            for (int e = 0; e < 3; e++)
+            {
+                const int n = e == 2 ? 0 : e + 1;
+                edge[e]     = (face.a[n] - face.a[e]) * (b - face.b[e]) - (face.b[n] - face.b[e]) * (a - face.a[e]);
+            }
+            const bool inside = (edge[0] >= 0 && edge[1] >= 0 && edge[2] >= 0) ||
+                                (edge[0] <= 0 && edge[1] <= 0 && edge[2] <= 0);
+            if (!inside) continue;
+            const Scalar tHit = (face.offset - face.normal.dot(pos)) / face.normal.dot(source.dir);
+            if (tHit >= 0 && tHit < *t)
+            {
+                *t  = tHit;
+                tet = face.tet;
+            }
+        }
+        return tet;
+    }
+    // 设置光子的起始四面体; 起点在网格外时移到沿方向的第一个边界交点
+    KOKKOS_INLINE_FUNCTION
+    void Resolve(const TetMesh &mesh, Photon3D &photon) const
+    {
+        if (source.type == SourceType::PENCIL || (source.type == SourceType::ISOTROPIC && m_startTet >= 0))
+        {
+            photon.pos        = m_startPos;
+            photon.curPyramid = m_startTet;
+            photon.alive      = m_startTet >= 0;
+            return;
+        }
+        Index tet            = -1;
+        Scalar t             = 0;
+        const Vec3f d        = photon.pos - source.pos;
+        const Scalar a       = d.dot(m_e1);
+        const Scalar b       = d.dot(m_e2);
+        const bool inRegion  = source.type != SourceType::ISOTROPIC && a >= m_lo1 && a <= m_hi1 && b >= m_lo2 &&
+                              b <= m_hi2;
+        if (source.type == SourceType::ISOTROPIC)
+        {
+            // 起点已知在网格外
+        }
+        else if (inRegion && m_tetsComplete)
+        {
+            for (size_t k = 0; k < m_candidateTets.extent(0) && tet < 0; k++)
+            {
+                if (mesh.InPyramid(m_candidateTets(k), photon.pos)) tet = m_candidateTets(k);
+            }
+        }
+        else
+        {
+            tet = mesh.LocateTet(photon.pos);
+        }
+        if (tet < 0 && inRegion && m_facesComplete)
+        {
+            tet = BeamEntry(photon.pos, a, b, &t);
+            if (tet >= 0) photon.pos = photon.pos + photon.dir * t;
+        }
+        else if (tet < 0)
+        {
+            tet = mesh.FirstBoundaryHit(photon.pos, photon.dir, &t);
+            if (tet >= 0) photon.pos = photon.pos + photon.dir * t;
+        }
+        photon.curPyramid = tet;
+        photon.alive      = tet >= 0;
+    }
+};
+
+// 传输引擎取第i个光子的初始状态: 单个Photon3D时所有光子相同, Photon3D数组(如SourceSampler的结果)时逐个给出
+KOKKOS_INLINE_FUNCTION
+const Photon3D &StartPhoton(const Photon3D &source, size_t) { return source; }
+template <class... Props>
+KOKKOS_INLINE_FUNCTION const Photon3D &StartPhoton(const Kokkos::View<Photon3D *, Props...> &starts, size_t i)
+{
+    return starts(i);
+}
+#endif
@@ -0,0 +1,203 @@
+#ifndef SPATIALINDEX_H
+#define SPATIALINDEX_H
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "Utils.h"
+
+// 轴对齐包围盒
+typedef struct AABB
+{
+    Vec3f lo{REALMAX, REALMAX, REALMAX};
+    Vec3f hi{-REALMAX, -REALMAX, -REALMAX};
+    KOKKOS_INLINE_FUNCTION
+    void Expand(const Point &p)
+    {
+        lo = Vec3f{Kokkos::fmin(lo.x, p.x), Kokkos::fmin(lo.y, p.y), Kokkos::fmin(lo.z, p.z)};
+        hi = Vec3f{Kokkos::fmax(hi.x, p.x), Kokkos::fmax(hi.y, p.y), Kokkos::fmax(hi.z, p.z)};
+    }
+    KOKKOS_INLINE_FUNCTION
+    void Expand(const AABB &b)
+    {
+        Expand(b.lo);
+        Expand(b.hi);
+    }
+    KOKKOS_INLINE_FUNCTION
+    Point Center() const { return (lo + hi) * (Scalar)0.5; }
+    KOKKOS_INLINE_FUNCTION
+    bool Contains(const Point &p) const
+    {
+        return p.x >= lo.x && p.x <= hi.x && p.y >= lo.y && p.y <= hi.y && p.z >= lo.z && p.z <= hi.z;
+    }
+    // slab法求射线与包围盒的相交区间, 与[0, tMax]不相交时返回false
+    KOKKOS_INLINE_FUNCTION
+    bool HitRay(const Point &orig, const Vec3f &invDir, Scalar tMax) const
+    {
+        Scalar t0 = 0, t1 = tMax;
+        const Scalar o[3] = {orig.x, orig.y, orig.z}, inv[3] = {invDir.x, invDir.y, invDir.z};
+        const Scalar l[3] = {lo.x, lo.y, lo.z}, h[3] = {hi.x, hi.y, hi.z};
+        for (int k = 0; k < 3; k++)
+        {
+            Scalar tNear = (l[k] - o[k]) * inv[k];
+            Scalar tFar  = (h[k] - o[k]) * inv[k];
+            if (tNear > tFar)
+            {
+                Scalar tmp = tNear;
+                tNear      = tFar;
+                tFar       = tmp;
+            }
+            t0 = tNear > t0 ? tNear : t0;
+            t1 = tFar < t1 ? tFar : t1;
+            if (t0 > t1) return false;
+        }
+        return true;
+    }
+} AABB;
+
+// 扁平化的BVH节点, 按深度优先顺序存储: 内部节点的左孩子紧跟其后, right为右孩子编号;
+// 叶节点的图元为 items[first, first + count)
+typedef struct BVHNode
+{
+    AABB box;
+    Index first = 0;  // 叶节点: 第一个图元在items中的位置; 内部节点: 右孩子编号
+    Index count = 0;  // 叶节点的图元数, 0 表示内部节点
+} BVHNode;
+
+// 层次包围盒: 在host上按最长轴中位数划分构建一次, 查询在设备上用定长栈遍历, 深度为O(log N).
+// 遍历时栈中最多有 深度 + 1 个节点, 构建时检查深度, 超过栈容量时抛出异常而不是在查询中丢弃节点
+class BVH
+{
+   public:
+    static constexpr int LEAF_SIZE  = 4;
+    static constexpr int STACK_SIZE = 64;
+
+    Kokkos::View<BVHNode *, ExecSpace> nodes;
+    Kokkos::View<Index *, ExecSpace> items;
+
+    size_t Bytes() const { return nodes.extent(0) * sizeof(BVHNode) + items.extent(0) * sizeof(Index); }
+
+    // boxes[i]为第i个图元的包围盒, ids[i]为查询时回调的图元编号
+    void Build(const std::vector<AABB> &boxes, const std::vector<Index> &ids, const char *label)
+    {
+        std::vector<BVHNode> hostNodes;
+        std::vector<Index> order(boxes.size());
+        std::vector<Point> centers(boxes.size());
+        for (size_t i = 0; i < boxes.size(); i++)
+        {
+            order[i]   = (Index)i;
+            centers[i] = boxes[i].Center();
+        }
+        hostNodes.reserve(boxes.empty() ? 1 : 2 * (boxes.size() / LEAF_SIZE + 1));
+        int depth = 0;
+        if (!boxes.empty()) BuildRange(boxes, centers, order, 0, order.size(), hostNodes, 0, depth);
+        if (depth + 1 > STACK_SIZE)
+        {
+            throw std::runtime_error(std::string(label) + ": BVH深度" + std::to_string(depth) + "超过遍历栈容量" +
+                                     std::to_string(STACK_SIZE));
+        }
+
+        nodes = Kokkos::View<BVHNode *, ExecSpace>(label, hostNodes.size());
+        items = Kokkos::View<Index *, ExecSpace>(label, order.size());
+        Kokkos::View<BVHNode *, Kokkos::HostSpace, Kokkos::MemoryTraits<Kokkos::Unmanaged>> nodes_h(hostNodes.data(),
+                                                                                                     hostNodes.size());
+        for (size_t i = 0; i < order.size(); i++) order[i] = ids[order[i]];
+        Kokkos::View<Index *, Kokkos::HostSpace, Kokkos::MemoryTraits<Kokkos::Unmanaged>> items_h(order.data(),
+                                                                                                 order.size());
+        Kokkos::deep_copy(nodes, nodes_h);
+        Kokkos::deep_copy(items, items_h);
+    }
+
+    // 对包围盒含有p的每个图元调用visit(item), visit返回true时停止并返回true
+    template <class Visit>
+    KOKKOS_INLINE_FUNCTION bool QueryPoint(const Point &p, Visit &&visit) const
+    {
+        if (nodes.extent(0) == 0) return false;
+        Index stack[STACK_SIZE];
+        int top        = 0;
+        stack[top++]   = 0;
+        while (top > 0)
+        {
+            const Index n       = stack[--top];
+            const BVHNode &node = nodes(n);
+            if (!node.box.Contains(p)) continue;
+            if (node.count > 0)
+            {
+                for (Index k = 0; k < node.count; k++)
+                {
+                    if (visit(items(node.first + k))) return true;
+                }
+            }
+            else
+            {
+                KOKKOS_ASSERT(top + 2 <= STACK_SIZE);
+                stack[top++] = node.first;
+                stack[top++] = n + 1;
+            }
+        }
+        return false;
+    }
+
+    // 对包围盒与射线段[0, tMax]相交的每个图元调用hit(item, tMax), hit可以缩短tMax以剪枝, 用于求最近交点
+    template <class Hit>
+    KOKKOS_INLINE_FUNCTION void QueryRay(const Point &orig, const Vec3f &dir, Scalar &tMax, Hit &&hit) const
+    {
+        if (nodes.extent(0) == 0) return;
+        const Vec3f invDir{1 / dir.x, 1 / dir.y, 1 / dir.z};
+        Index stack[STACK_SIZE];
+        int top      = 0;
+        stack[top++] = 0;
+        while (top > 0)
+        {
+            const Index n       = stack[--top];
+            const BVHNode &node = nodes(n);
+            if (!node.box.HitRay(orig, invDir, tMax)) continue;
+            if (node.count > 0)
+            {
+                for (Index k = 0; k < node.count; k++) hit(items(node.first + k), tMax);
+            }
+            else
+            {
+                KOKKOS_ASSERT(top + 2 <= STACK_SIZE);
+                stack[top++] = node.first;
+                stack[top++] = n + 1;
+            }
+        }
+    }
+
+   private:
+    // depth为当前节点的深度(根为0), maxDepth记录叶节点的最大深度
+    static Index BuildRange(const std::vector<AABB> &boxes, const std::vector<Point> &centers,
+                            std::vector<Index> &order, size_t begin, size_t end, std::vector<BVHNode> &hostNodes,
+                            int depth, int &maxDepth)
+    {
+        const Index self = (Index)hostNodes.size();
+        maxDepth         = depth > maxDepth ? depth : maxDepth;
+        hostNodes.emplace_back();
+        AABB box, centerBox;
+        for (size_t i = begin; i < end; i++)
+        {
+            box.Expand(boxes[order[i]]);
+            centerBox.Expand(centers[order[i]]);
+        }
+        hostNodes[self].box = box;
+        if (end - begin <= (size_t)LEAF_SIZE)
+        {
+            hostNodes[self].first = (Index)begin;
+            hostNodes[self].count = (Index)(end - begin);
+            return self;
+        }
+        const Vec3f extent = centerBox.hi - centerBox.lo;
+        const int axis     = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+        auto key           = [&centers, axis](Index i)
+        { return axis == 0 ? centers[i].x : (axis == 1 ? centers[i].y : centers[i].z); };
+        const size_t mid = begin + (end - begin) / 2;
+        std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+                         [&key](Index a, Index b) { return key(a) < key(b); });
+        BuildRange(boxes, centers, order, begin, mid, hostNodes, depth + 1, maxDepth);
+        const Index right     = BuildRange(boxes, centers, order, mid, end, hostNodes, depth + 1, maxDepth);
+        hostNodes[self].first = right;
+        return self;
+    }
+};
+#endif
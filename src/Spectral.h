@@ -0,0 +1,160 @@
+#ifndef SPECTRAL_H
+#define SPECTRAL_H
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "Mesh.h"
+
+// 多组光学参数(如多个波长)的一次传输
+// 各组只有μa不同, μs、g、n相同. 四面体的穿越、散射和界面反射都与μa无关, 所有组共用同一条路径:
+// 行走时只按μs抽样自由程, 作用点只散射不吸收, 光子记录在各域中走过的路径长度L_d;
+// 第k组的权重按Beer-Lambert定律给出 w_k = w * exp(-Σ_d μa_{k,d} * L_d),
+// 每段长为len的路径在所在四面体中吸收 w_k * (1 - exp(-μa_{k,d} * len)).
+// 每组的期望与用该组材料单独运行相同, 方差在μa/μs较大时高于逐次吸收.
+// 轮盘赌按各组中最大可能的权重 w * exp(-Σ_d min_k μa_{k,d} * L_d) 判断, 存活时所有组一起放大
+constexpr int MAX_PATH_DOMAINS = 8;  // 记录路径长度的域数, 域编号为1..MAX_PATH_DOMAINS
+
+// 网格中用到的域编号(按编号索引), 按域记录路径的模式(光谱/重放)要求域编号不超过MAX_PATH_DOMAINS
+inline std::vector<bool> PathDomains(const TetMesh &mesh, const std::string &mode)
+{
+    auto tetMaterials_h = Kokkos::create_mirror_view_and_copy(Kokkos::HostSpace(), mesh.tetMaterials);
+    std::vector<bool> used(MaterialTable::MAX_MATERIALS, false);
+    for (size_t i = 0; i < tetMaterials_h.extent(0); i++) used[tetMaterials_h(i)] = true;
+    for (int d = MAX_PATH_DOMAINS + 1; d < MaterialTable::MAX_MATERIALS; d++)
+    {
+        if (used[d]) throw std::runtime_error(mode + "只支持域编号1~" + std::to_string(MAX_PATH_DOMAINS));
+    }
+    return used;
+}
+
+class SpectralSets
+{
+   public:
+    using MuaTable = Kokkos::View<Scalar **, Kokkos::LayoutRight, ExecSpace>;
+    int numSets = 0;
+    MuaTable mua;                          // (组, 域编号 - 1)
+    Scalar muaMin[MAX_PATH_DOMAINS] = {};  // 各域在所有组中最小的μa
+    // (四面体, 组)的累计吸收权重, 不统计吸收时为空
+    Kokkos::View<Accum **, Kokkos::LayoutRight, ExecSpace> absorbed;
+
+    SpectralSets() = default;
+    // sets[k]为第k组按域编号给出的属性(与SetMaterials的格式相同), 网格的材料应为sets[0];
+    // 网格中用到的域的μs、g、n在各组间必须相同
+    SpectralSets(const TetMesh &mesh, const std::vector<std::vector<Attribute>> &sets, bool tallyAbsorption)
+    {
+        if (sets.empty()) throw std::runtime_error("光谱模式至少需要一组光学参数");
+        const std::vector<bool> used = PathDomains(mesh, "光谱模式");
+        numSets   = (int)sets.size();
+        mua       = MuaTable("spectralMua", numSets, MAX_PATH_DOMAINS);
+        m_muaHost = Kokkos::create_mirror_view(mua);
+        for (int k = 0; k < numSets; k++)
+        {
+            for (int d = 1; d <= MAX_PATH_DOMAINS; d++)
+            {
+                m_muaHost(k, d - 1) = 0;
+                if (!used[d]) continue;
+                if ((size_t)d >= sets[k].size() || sets[k][d].mua < 0 || IsNan(sets[k][d].mua))
+                {
+                    throw std::runtime_error("第" + std::to_string(k) + "组没有给出域" + std::to_string(d) + "的μa");
+                }
+                const Attribute &a = sets[k][d], &ref = sets[0][d];
+                if (a.mus != ref.mus || a.g != ref.g || a.n != ref.n)
+                {
+                    throw std::runtime_error("第" + std::to_string(k) + "组域" + std::to_string(d) +
+                                             "的μs/g/n与第0组不同, 光谱模式只允许μa不同");
+                }
+                m_muaHost(k, d - 1) = a.mua;
+            }
+        }
+        for (int d = 0; d < MAX_PATH_DOMAINS; d++)
+        {
+            muaMin[d] = m_muaHost(0, d);
+            for (int k = 1; k < numSets; k++) muaMin[d] = Kokkos::fmin(muaMin[d], m_muaHost(k, d));
+        }
+        Kokkos::deep_copy(mua, m_muaHost);
+        if (tallyAbsorption)
+        {
+            absorbed = Kokkos::View<Accum **, Kokkos::LayoutRight, ExecSpace>("spectralAbsorbed", mesh.NumTets(),
+                                                                             numSets);
+        }
+    }
+
+    KOKKOS_INLINE_FUNCTION
+    bool Enabled() const { return numSets > 0; }
+    // 四面体材料编号在path中的下标
+    KOKKOS_INLINE_FUNCTION
+    static int Slot(uint8_t domain) { return (int)domain - 1; }
+    // 第set组沿路径path的衰减 exp(-Σ_d μa_{set,d} * L_d)
+    KOKKOS_INLINE_FUNCTION
+    Accum Attenuation(int set, const Scalar *path) const
+    {
+        Accum sum = 0;
+        for (int d = 0; d < MAX_PATH_DOMAINS; d++) sum += (Accum)mua(set, d) * (Accum)path[d];
+        return Kokkos::exp(-sum);
+    }
+    // 各组中最小的衰减, 轮盘赌使用
+    KOKKOS_INLINE_FUNCTION
+    Accum MaxAttenuation(const Scalar *path) const
+    {
+        Accum sum = 0;
+        for (int d = 0; d < MAX_PATH_DOMAINS; d++) sum += (Accum)muaMin[d] * (Accum)path[d];
+        return Kokkos::exp(-sum);
+    }
+    // 在tet(域下标slot)中走长为len的一段, path为走这一段之前的路径长度
+    KOKKOS_INLINE_FUNCTION
+    void Deposit(Index tet, int slot, Accum weight, const Scalar *path, Scalar len) const
+    {
+        if (absorbed.extent(0) == 0) return;
+        for (int k = 0; k < numSets; k++)
+        {
+            const Scalar mua_ = mua(k, slot);
+            if (mua_ <= 0) continue;
+            const Accum w = weight * Attenuation(k, path);
+            Kokkos::atomic_add(&absorbed(tet, k), -w * Kokkos::expm1(-(Accum)mua_ * (Accum)len));
+        }
+    }
+    // host上计算第set组的衰减, 用于拷回host的结果
+    Accum HostAttenuation(int set, const Scalar *path) const
+    {
+        Accum sum = 0;
+        for (int d = 0; d < MAX_PATH_DOMAINS; d++) sum += (Accum)m_muaHost(set, d) * (Accum)path[d];
+        return std::exp(-sum);
+    }
+    void Reset()
+    {
+        if (absorbed.extent(0) > 0) Kokkos::deep_copy(absorbed, (Accum)0);
+    }
+    // 第set组的光通量 = 吸收权重 / (μa * 体积 * 光子数), 与AbsorptionTally::Fluence相同
+    Kokkos::View<Accum *, ExecSpace> Fluence(const TetMesh &mesh, int set, uint64_t numPhotons) const
+    {
+        Kokkos::View<Accum *, ExecSpace> fluence("spectralFluence", absorbed.extent(0));
+        auto absorbed_    = absorbed;
+        auto mua_         = mua;
+        const Accum scale = numPhotons > 0 ? 1 / (Accum)numPhotons : 0;
+        Kokkos::parallel_for(
+            "ComputeSpectralFluence", Kokkos::RangePolicy<ExecSpace>(0, absorbed.extent(0)),
+            KOKKOS_LAMBDA(const Index i)
+            {
+                const Accum mua    = mua_(set, Slot(mesh.tetMaterials(i)));
+                const Accum volume = mesh.Volume(i);
+                fluence(i)         = mua > 0 && volume > 0 ? absorbed_(i, set) * scale / (mua * volume) : 0;
+            });
+        return fluence;
+    }
+
+   private:
+    typename MuaTable::HostMirror m_muaHost;
+};
+
+// 第set组的出射权重, 作为DetectorSet::Accumulate等逐光子统计的权重
+typedef struct SetWeight
+{
+    SpectralSets sets;
+    int set = 0;
+    template <class Result>
+    KOKKOS_INLINE_FUNCTION Accum operator()(const Result &r) const
+    {
+        return r.weight * sets.Attenuation(set, r.path);
+    }
+} SetWeight;
+#endif
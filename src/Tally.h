@@ -0,0 +1,202 @@
+#ifndef TALLY_H
+#define TALLY_H
+#include <Kokkos_ScatterView.hpp>
+#include <vector>
+#include "Mesh.h"
+
+// 按四面体编号累计的吸收能量, 在设备上累加
+// 累加方式:
+//   ATOMIC  所有线程原子加到同一个数组, GPU上最快
+//   SCATTER Kokkos ScatterView, host多线程后端为每个线程复制一份数组, 结束时归约
+//   HYBRID  光源附近的热点四面体用ScatterView复制, 其余四面体原子加, 复制的内存只与热点数有关
+//   AUTO    按后端和网格大小自动选择
+class AbsorptionTally
+{
+   public:
+    enum class Mode
+    {
+        NONE,
+        ATOMIC,
+        SCATTER,
+        HYBRID,
+        AUTO
+    };
+    using ScatterType = Kokkos::Experimental::ScatterView<Accum *, Kokkos::LayoutRight, ExecSpace>;
+    // SCATTER模式下各线程副本总大小的上限, 超过时AUTO改用HYBRID
+    static constexpr size_t DUPLICATE_BUDGET = size_t(512) << 20;
+    static constexpr Index DEFAULT_HOT_TETS  = 4096;
+
+    Mode mode = Mode::NONE;
+    Kokkos::View<Accum *, ExecSpace> absorbed;     // 每个四面体的累计吸收权重
+    Kokkos::View<Accum *, ExecSpace> hotAbsorbed;  // HYBRID: 热点四面体的累计值(按热点编号)
+    Kokkos::View<Index *, ExecSpace> hotSlot;       // HYBRID: 四面体 -> 热点编号, -1 表示非热点
+    Kokkos::View<Index *, ExecSpace> hotTets;       // HYBRID: 热点编号 -> 四面体
+    ScatterType scatter;
+
+    AbsorptionTally() = default;
+    AbsorptionTally(const TetMesh &mesh, Mode requested) { Init(mesh, requested); }
+
+    static Mode DefaultMode(Index numTets)
+    {
+        if (!Kokkos::SpaceAccessibility<Kokkos::HostSpace, ExecSpace::memory_space>::accessible) return Mode::ATOMIC;
+        const size_t concurrency = (size_t)ExecSpace().concurrency();
+        if (concurrency <= 1) return Mode::ATOMIC;
+        return (size_t)numTets * concurrency * sizeof(Accum) <= DUPLICATE_BUDGET ? Mode::SCATTER : Mode::HYBRID;
+    }
+    static const char *ModeName(Mode m)
+    {
+        switch (m)
+        {
+            case Mode::ATOMIC: return "atomic";
+            case Mode::SCATTER: return "scatter";
+            case Mode::HYBRID: return "hybrid";
+            case Mode::AUTO: return "auto";
+            default: return "none";
+        }
+    }
+
+    void Init(const TetMesh &mesh, Mode requested)
+    {
+        *this    = AbsorptionTally();  // 丢弃旧的统计和热点
+        mode     = requested == Mode::AUTO ? DefaultMode(mesh.NumTets()) : requested;
+        absorbed = Kokkos::View<Accum *, ExecSpace>("absorbed", mode == Mode::NONE ? 0 : mesh.NumTets());
+        if (mode == Mode::SCATTER)
+        {
+            scatter = ScatterType(absorbed);
+        }
+        else if (mode == Mode::HYBRID)
+        {
+            // 没有指定光源位置时先以网格中心为热点区域
+            auto root = Kokkos::create_mirror_view_and_copy(Kokkos::HostSpace(), mesh.tetTree.nodes);
+            SetHotRegion(mesh, root.extent(0) > 0 ? root(0).box.Center() : Point{0, 0, 0}, DEFAULT_HOT_TETS);
+        }
+    }
+    // HYBRID: 以包含center的四面体为起点沿面邻接广度优先取count个四面体作为热点.
+    // 每次run都会调用, 网格、起点四面体和count都不变时沿用已有的热点, 不重新查找和分配
+    void SetHotRegion(const TetMesh &mesh, const Point &center, Index count)
+    {
+        if (mode != Mode::HYBRID) return;
+        const void *meshKey = mesh.faceNeighbors.data();
+        const bool sameMesh = hotTets.extent(0) > 0 && meshKey == m_hotMesh && count == m_hotCount;
+        if (sameMesh && center.x == m_hotCenter.x && center.y == m_hotCenter.y && center.z == m_hotCenter.z) return;
+        Kokkos::View<Index, ExecSpace> start("hotStart");
+        Kokkos::parallel_for(
+            "LocateHotStart", Kokkos::RangePolicy<ExecSpace>(0, 1),
+            KOKKOS_LAMBDA(const int) { start() = mesh.LocateTet(center); });
+        auto start_h = Kokkos::create_mirror_view_and_copy(Kokkos::HostSpace(), start);
+        m_hotCenter  = center;
+        if (sameMesh && start_h() == m_hotStart) return;
+        m_hotMesh  = meshKey;
+        m_hotCount = count;
+        m_hotStart = start_h();
+        // 先把旧热点的累计值并入absorbed
+        if (hotTets.extent(0) > 0) Finalize();
+        auto neighbors = Kokkos::create_mirror_view_and_copy(Kokkos::HostSpace(), mesh.faceNeighbors);
+
+        std::vector<Index> slot(mesh.NumTets(), -1), order;
+        if (start_h() >= 0)
+        {
+            slot[start_h()] = 0;
+            order.push_back(start_h());
+        }
+        for (size_t head = 0; head < order.size() && (Index)order.size() < count; head++)
+        {
+            for (int f = 0; f < 4 && (Index)order.size() < count; f++)
+            {
+                const Index nb = neighbors(order[head])[f];
+                if (nb < 0 || slot[nb] >= 0) continue;
+                slot[nb] = (Index)order.size();
+                order.push_back(nb);
+            }
+        }
+        Kokkos::View<Index *, Kokkos::HostSpace, Kokkos::MemoryTraits<Kokkos::Unmanaged>> slot_h(slot.data(),
+                                                                                                slot.size());
+        Kokkos::View<Index *, Kokkos::HostSpace, Kokkos::MemoryTraits<Kokkos::Unmanaged>> order_h(order.data(),
+                                                                                                 order.size());
+        hotSlot     = Kokkos::View<Index *, ExecSpace>("hotSlot", slot.size());
+        hotTets     = Kokkos::View<Index *, ExecSpace>("hotTets", order.size());
+        hotAbsorbed = Kokkos::View<Accum *, ExecSpace>("hotAbsorbed", order.size());
+        Kokkos::deep_copy(hotSlot, slot_h);
+        Kokkos::deep_copy(hotTets, order_h);
+        scatter = ScatterType(hotAbsorbed);
+    }
+
+    KOKKOS_INLINE_FUNCTION
+    bool Enabled() const { return mode != Mode::NONE; }
+    KOKKOS_INLINE_FUNCTION
+    void Deposit(Index tet, Accum w) const
+    {
+        switch (mode)
+        {
+            case Mode::ATOMIC: Kokkos::atomic_add(&absorbed(tet), w); break;
+            case Mode::SCATTER: scatter.access()(tet) += w; break;
+            case Mode::HYBRID:
+            {
+                const Index s = hotSlot(tet);
+                if (s >= 0)
+                    scatter.access()(s) += w;
+                else
+                    Kokkos::atomic_add(&absorbed(tet), w);
+                break;
+            }
+            default: break;
+        }
+    }
+
+    // 把各线程副本归约进absorbed, 每次读取结果前调用; 可以多次调用, 之后继续累加
+    void Finalize()
+    {
+        if (mode == Mode::SCATTER)
+        {
+            Kokkos::Experimental::contribute(absorbed, scatter);
+            scatter.reset_except(absorbed);
+        }
+        else if (mode == Mode::HYBRID)
+        {
+            Kokkos::Experimental::contribute(hotAbsorbed, scatter);
+            scatter.reset_except(hotAbsorbed);
+            auto absorbed_    = absorbed;
+            auto hotAbsorbed_ = hotAbsorbed;
+            auto hotTets_     = hotTets;
+            Kokkos::parallel_for(
+                "MergeHotAbsorbed", Kokkos::RangePolicy<ExecSpace>(0, hotTets.extent(0)),
+                KOKKOS_LAMBDA(const Index s)
+                {
+                    absorbed_(hotTets_(s)) += hotAbsorbed_(s);
+                    hotAbsorbed_(s) = 0;
+                });
+        }
+    }
+    void Reset()
+    {
+        Kokkos::deep_copy(absorbed, (Accum)0);
+        if (mode == Mode::HYBRID) Kokkos::deep_copy(hotAbsorbed, (Accum)0);
+        if (mode == Mode::SCATTER || mode == Mode::HYBRID) scatter.reset();
+    }
+
+    // 光通量(fluence) = 吸收权重 / (mua * 体积 * 光子数); mua为0的四面体没有吸收, 记为0
+    Kokkos::View<Accum *, ExecSpace> Fluence(const TetMesh &mesh, uint64_t numPhotons)
+    {
+        Finalize();
+        Kokkos::View<Accum *, ExecSpace> fluence("fluence", absorbed.extent(0));
+        auto absorbed_     = absorbed;
+        const Accum scale = numPhotons > 0 ? 1 / (Accum)numPhotons : 0;
+        Kokkos::parallel_for(
+            "ComputeFluence", Kokkos::RangePolicy<ExecSpace>(0, absorbed.extent(0)),
+            KOKKOS_LAMBDA(const Index i)
+            {
+                const Accum mua    = mesh.GetMaterial(i).mua;
+                const Accum volume = mesh.Volume(i);
+                fluence(i)         = mua > 0 && volume > 0 ? absorbed_(i) * scale / (mua * volume) : 0;
+            });
+        return fluence;
+    }
+
+   private:
+    // HYBRID: 当前热点对应的网格(faceNeighbors的地址)、count、起点四面体和最近一次的center
+    const void *m_hotMesh = nullptr;
+    Index m_hotCount      = 0;
+    Index m_hotStart      = -1;
+    Point m_hotCenter{0, 0, 0};
+};
+#endif
@@ -0,0 +1,78 @@
+#ifndef TETWALK_H
+#define TETWALK_H
+#include "Mesh.h"
+
+// 基于Plücker坐标的四面体走行
+// 以光子位置为原点时, 射线与有向棱 a->b 的Plücker内积化为三重积 dir·(a×b),
+// 6条棱的内积在4个面之间共享, 射线从所有棱符号均非负的面离开四面体.
+// 落在棱或顶点上时多个面同时满足条件, 取最小棱符号最大的面即可继续走行, 不需要在邻居中试探.
+class TetWalk
+{
+   public:
+    typedef struct Step
+    {
+        Index nextTet = -1;  // 出射面对面的四面体, 负数表示离开网格(见TetMesh::BoundaryCode)
+        int face      = -1;  // 出射面在当前四面体中的局部编号
+        Scalar dist   = 0;   // 沿dir到出射面的距离
+    } Step;
+
+    KOKKOS_INLINE_FUNCTION
+    static Scalar Triple(const Vec3f &dir, const Vec3f &a, const Vec3f &b)
+    {
+        return dir.x * (a.y * b.z - a.z * b.y) + dir.y * (a.z * b.x - a.x * b.z) + dir.z * (a.x * b.y - a.y * b.x);
+    }
+
+    // q为四面体顶点相对光子位置的坐标, 要求四面体已按正朝向存储(见TetMesh::load_from_file)
+    // 返回出射面编号, weight为该面3个顶点(按TetFaceVertex顺序)的重心坐标权重(未归一化)
+    KOKKOS_INLINE_FUNCTION
+    static int ExitFace(const Vec3f q[4], const Vec3f &dir, Scalar weight[3])
+    {
+        const Scalar s01 = Triple(dir, q[0], q[1]);
+        const Scalar s02 = Triple(dir, q[0], q[2]);
+        const Scalar s03 = Triple(dir, q[0], q[3]);
+        const Scalar s12 = Triple(dir, q[1], q[2]);
+        const Scalar s13 = Triple(dir, q[1], q[3]);
+        const Scalar s23 = Triple(dir, q[2], q[3]);
+        // 每个面3个顶点的权重即对边的Plücker内积, 外法向绕向下离开时均非负
+        const Scalar w[4][3] = {{-s12, s02, -s01}, {s13, -s03, s01}, {-s23, s03, -s02}, {s23, -s13, s12}};
+        int best             = 0;
+        Scalar bestMin       = -REALMAX;
+        for (int f = 0; f < 4; f++)
+        {
+            Scalar m = Kokkos::fmin(w[f][0], Kokkos::fmin(w[f][1], w[f][2]));
+            if (m > bestMin && w[f][0] + w[f][1] + w[f][2] > 0)
+            {
+                bestMin = m;
+                best    = f;
+            }
+        }
+        for (int k = 0; k < 3; k++) weight[k] = w[best][k];
+        return best;
+    }
+
+    // 从tet内的pos沿dir走到出射面, 一次查表得到下一个四面体
+    KOKKOS_INLINE_FUNCTION
+    static Step Next(const TetMesh &mesh, Index tet, const Point &pos, const Vec3f &dir)
+    {
+        Step step;
+        const Index4 v = mesh.tetVertices(tet);
+        Vec3f q[4];
+        for (int k = 0; k < 4; k++) q[k] = mesh.vertices(v[k]) - pos;
+        Scalar weight[3];
+        step.face = ExitFace(q, dir, weight);
+
+        // 出射点取面上的重心坐标插值, 保证落在出射面内
+        const Scalar sum = weight[0] + weight[1] + weight[2];
+        if (sum > 0)
+        {
+            Vec3f hit = (q[TetFaceVertex(step.face, 0)] * weight[0] + q[TetFaceVertex(step.face, 1)] * weight[1] +
+                         q[TetFaceVertex(step.face, 2)] * weight[2]) /
+                        sum;
+            Scalar dist = hit.x * dir.x + hit.y * dir.y + hit.z * dir.z;
+            step.dist   = dist > 0 ? dist : 0;
+        }
+        step.nextTet = mesh.faceNeighbors(tet)[step.face];
+        return step;
+    }
+};
+#endif
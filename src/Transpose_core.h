@@ -1,51 +1,65 @@
 #ifndef TRANSPOSE_CORE_H
 #define TRANSPOSE_CORE_H
+#include <type_traits>
+#include "Collect.h"
+#include "Counters.h"
 #include "Mesh.h"
+#include "Random.h"
+#include "Sampling.h"
+#include "Spectral.h"
+#include "Tally.h"
+#include "TetWalk.h"
 
 struct Photon3D
 {
     Point pos{0, 0, 0};
     Vec3f dir{0, 0, 1};
-    Scalar weight = 1.0f;
-    Scalar max_z  = 0;
-    Scalar Ps     = 0;
-    int type      = 0;
-    bool alive    = true;
-    Index curPyramid;
-    Index nextPyramid;
-    Face nextFace;
-};
-enum class CollectType
-{
-    EMIT       = 0,
-    COLLECT    = 1,
-    OUTOFRANGE = 2,
-    IGNORE     = -1
+    Accum weight      = 1;
+    Scalar max_z      = 0;
+    Scalar Ps         = 0;  // 累计的几何路径长度
+    Scalar time       = 0;  // 累计的飞行时间(ns), 按所经四面体的折射率计算
+    int type          = 0;
+    bool alive        = true;
+    Index curPyramid  = -1;
+    Index nextPyramid = -1;
+    int nextFace      = -1;  // 出射面在curPyramid中的局部编号(0..3)
+    // 光谱模式或记录路径时: 在域1..MAX_PATH_DOMAINS中走过的路径长度和散射次数
+    Scalar path[MAX_PATH_DOMAINS]       = {};
+    uint32_t scatters[MAX_PATH_DOMAINS] = {};
 };
 typedef struct resultType
 {
-    CollectType type = CollectType::IGNORE;
-    Index pyramidIndex;
+    CollectType type   = CollectType::IGNORE;
+    Index pyramidIndex = -1;  // COLLECT: 收集的四面体; 从边界离开时: 出射的四面体; 进入标为OUTOFRANGE的四面体时: 之前所在的四面体
+    int face           = -1;  // 从边界离开时: 出射面在pyramidIndex中的局部编号
     Point pos;
     Vec3f dir;
-    Scalar weight;
+    Accum weight = 0;
+    Scalar Ps   = 0;  // 离开/被收集时的几何路径长度
+    Scalar time = 0;  // 离开/被收集时的飞行时间(ns)
+    // 光谱模式或记录路径时: 各域中的路径长度(第k组的权重见SpectralSets::Attenuation)和散射次数
+    Scalar path[MAX_PATH_DOMAINS]       = {};
+    uint32_t scatters[MAX_PATH_DOMAINS] = {};
 } resultType;
-// 由于虚函数表的问题，在cuda上运行的不能直接使用虚函数
-class DefaultCollectStrategy
+// 每次运行可选的传输设置, 整体传给传输引擎和transpose_core
+typedef struct TransportOptions
 {
-   public:
-    static constexpr int EMIT = 0;
-    Kokkos::UnorderedMap<Index, CollectType, ExecSpace>& collect_map;
-    DefaultCollectStrategy(Kokkos::UnorderedMap<Index, CollectType, ExecSpace>& collect_map) : collect_map(collect_map)
-    {
-    }
-    KOKKOS_FUNCTION
-    CollectType GetCollectType(Index pyIndex) const
-    {
-        Kokkos::printf("%s\n", __LINE__);
-        return collect_map.value_at(pyIndex);
-    }
+    Scalar timeGate       = REALMAX;               // 飞行时间(ns)超过该值的光子不再有贡献, 直接终止
+    FresnelMode fresnel   = FresnelMode::EXACT;    // 界面反射率的计算方式
+    SamplingMode sampling = SamplingMode::EXACT;   // 自由程和散射方向的抽样方式
+    bool recordPaths      = false;                 // 记录各域的路径长度和散射次数(微扰/重放, 见Replay.h)
+} TransportOptions;
+
+// 传输过程的日志级别, 作为transpose_core的模板参数在编译期选择
+//   NONE   生产版本, 不含任何日志代码和分支
+//   PHOTON 单光子跟踪, 每个函数进出时打印光子状态, Run::run(1)使用
+enum class TraceLevel
+{
+    NONE,
+    PHOTON
 };
+// Collect为收集策略(见Collect.h), 由于虚函数表的问题，在cuda上运行的不能直接使用虚函数, 改为模板参数
+template <TraceLevel trace = TraceLevel::NONE, class Collect = TetLabelCollect>
 class transpose_core
 {
     // 单个光子的传输过程，包括发射、传输、吸收、散射、收集
@@ -55,18 +69,27 @@ class transpose_core
     const TetMesh& m_mesh;
     Photon3D m_photon;
     resultType result;
-    const RandPoolType& rand_pool;
-    const DefaultCollectStrategy& m_collectStrategy;
+    PhiloxRandom m_random;  // 按(种子, 光子编号)确定的随机数流
+    const Collect& m_collectStrategy;
+    const AbsorptionTally* m_tally = nullptr;  // 为空时吸收的能量不做统计
+    const SpectralSets* m_spectral = nullptr;  // 非空时为光谱模式, 见Spectral.h
+    TransportOptions m_options;
+    Counters counters;  // 本光子的热路径计数, 由传输kernel归约; 未定义MC_INSTRUMENT时为空
     KOKKOS_INLINE_FUNCTION
-    transpose_core(const TetMesh& mesh, const DefaultCollectStrategy& collectStrategy, const RandPoolType& rand_pool)
-        : m_mesh(mesh), m_collectStrategy(collectStrategy), m_photon(), rand_pool(rand_pool)
+    transpose_core(const TetMesh& mesh, const Collect& collectStrategy, const PhiloxRandom& random)
+        : m_mesh(mesh), m_photon(), m_random(random), m_collectStrategy(collectStrategy)
     {
     }
     KOKKOS_INLINE_FUNCTION
-    void run(bool log = false)
+    void run()
     {
-        set_log(log);
-        Emit();
+        counters.Add(Counter::PHOTONS);
+        if (!Emit())
+        {
+            // 不与网格相交的光子直接结束, 结果为IGNORE
+            m_photon.alive = false;
+            return;
+        }
         int i = MAX_ITER;
         CheckInit();
         while (m_photon.alive && i--)
@@ -74,17 +97,18 @@ class transpose_core
             Move();
             Roulette();
         }
-
-        result.type = CollectType::IGNORE;
+        if (i < 0) counters.Add(Counter::RUN_LIMIT);
     }
-    bool m_log = false;
     KOKKOS_INLINE_FUNCTION
-    void set_log(bool log) { m_log = log; }
+    void set_tally(const AbsorptionTally& tally) { m_tally = tally.Enabled() ? &tally : nullptr; }
+    KOKKOS_INLINE_FUNCTION
+    void set_options(const TransportOptions& options) { m_options = options; }
+    KOKKOS_INLINE_FUNCTION
+    void set_spectral(const SpectralSets& spectral) { m_spectral = spectral.Enabled() ? &spectral : nullptr; }
     template <typename... Args>
     KOKKOS_FORCEINLINE_FUNCTION void Printf(const char* format, Args... args)
     {
-        if (!m_log) return;
-        Kokkos::printf(format, args...);
+        if constexpr (trace != TraceLevel::NONE) Kokkos::printf(format, args...);
     }
     template <typename... Args>
     KOKKOS_FORCEINLINE_FUNCTION void Printf_error(const char* format, Args... args)
@@ -103,7 +127,7 @@ class transpose_core
         {
             m_core.Printf("m_photon.curPyramid: %d\n", m_core.m_photon.curPyramid);
             m_core.Printf("m_photon.nextPyramid: %d\n", m_core.m_photon.nextPyramid);
-            m_core.Printf("m_mesh.pyramids.extent(0): %d\n", m_core.m_mesh.pyramids.extent(0));
+            m_core.Printf("m_mesh.NumTets(): %d\n", m_core.m_mesh.NumTets());
             m_core.Printf("m_photon.alive: %d\n", m_core.m_photon.alive);
             m_core.Printf("m_photon.weight: %f\n", m_core.m_photon.weight);
             m_core.Printf("m_photon.max_z: %f\n", m_core.m_photon.max_z);
@@ -131,162 +155,94 @@ class transpose_core
             m_core.Printf("---------------------------END FUNCTION <%s>---------------------------------\n", m_func_name);
         }
     } Function_log_guard;
-#define FUNCTION_LOG_GUARD Function_log_guard guard(*this, (const char*)__FUNCTION__, (const char*)__FILE__, __LINE__);
+    // 生产版本使用的空guard, 构造和析构都不产生代码
+    typedef struct No_log_guard
+    {
+        KOKKOS_INLINE_FUNCTION
+        No_log_guard(transpose_core&, const char*, const char*, int) {}
+    } No_log_guard;
+    using Log_guard = std::conditional_t<trace == TraceLevel::NONE, No_log_guard, Function_log_guard>;
+#define FUNCTION_LOG_GUARD \
+    [[maybe_unused]] Log_guard guard(*this, (const char*)__FUNCTION__, (const char*)__FILE__, __LINE__);
     KOKKOS_INLINE_FUNCTION
     void CheckInit()
     {
         FUNCTION_LOG_GUARD;
         Printf("m_photon.curPyramid: %d\n", m_photon.curPyramid);
-        Printf("m_mesh.pyramids.extent(0): %d\n", m_mesh.pyramids.extent(0));
-        KOKKOS_ASSERT(m_photon.curPyramid > 0);
-        KOKKOS_ASSERT(m_photon.curPyramid < m_mesh.pyramids.extent(0));
-        KOKKOS_ASSERT(m_photon.dir.norm() == 1);
+        Printf("m_mesh.NumTets(): %d\n", m_mesh.NumTets());
+        KOKKOS_ASSERT(m_photon.curPyramid >= 0);
+        KOKKOS_ASSERT(m_photon.curPyramid < m_mesh.NumTets());
+        KOKKOS_ASSERT(Kokkos::fabs(m_photon.dir.norm() - 1) <= 64 * REALEPS);
     }
     KOKKOS_INLINE_FUNCTION
-    Scalar GetRandom(Scalar lower = 0, Scalar upper = 1) { return rand_pool.get_state().drand(); }
+    Scalar GetRandom(Scalar lower = 0, Scalar upper = 1)
+    {
+        return lower + (upper - lower) * m_random.Uniform();
+    }
+    // 入射点等落在面上的起点与面的距离只有舍入误差, 按坐标的量级放宽
+    KOKKOS_INLINE_FUNCTION
+    Scalar FaceTolerance() const
+    {
+        const Point& p = m_photon.pos;
+        return 64 * REALEPS * (1 + Kokkos::fmax(Kokkos::fabs(p.x), Kokkos::fmax(Kokkos::fabs(p.y), Kokkos::fabs(p.z))));
+    }
     KOKKOS_INLINE_FUNCTION
     int FindCurPyramid()
     {
-        for (int i = 0; i < m_mesh.pyramids.extent(0); i++)
-        {
-            if (m_mesh.pyramids[i].InPyramid(m_photon.pos))
-            {
-                return i;
-            }
-        }
-        return -1;
+        counters.Add(Counter::LOCATE_FALLBACKS);
+        return m_mesh.LocateTet(m_photon.pos);
     }
     KOKKOS_INLINE_FUNCTION
     bool Emit()
     {
         FUNCTION_LOG_GUARD;
 
-        // emit a photon
+        // emit a photon; 光源抽样时已判定不与网格相交的光子(见SourceSampler)不再查找
+        if (!m_photon.alive) return false;
         if (m_photon.curPyramid == -1)
         {
-            Printf_error(
-                "未指定初始位置所在pyramid, emit需要计算光子初始位置所在pyramid, 此操作会耗费大量时间, "
-                "请尽量使用预设curPyramid\n");
+            Printf("未指定初始位置所在pyramid, 通过空间索引查找\n");
             m_photon.curPyramid = FindCurPyramid();
         }
-        else if (!m_mesh.pyramids[m_photon.curPyramid].InPyramid(m_photon.pos))
+        else if (!m_mesh.InPyramid(m_photon.curPyramid, m_photon.pos, FaceTolerance()))
         {
-            Printf_error("curPyramid: %d 设置错误, 重新计算中，此操作会耗费大量时间, 请正确预设curPyramid\n",
-                         m_photon.curPyramid);
+            Printf_error("curPyramid: %d 设置错误, 通过空间索引重新查找\n", m_photon.curPyramid);
             m_photon.curPyramid = FindCurPyramid();
         }
         if (m_photon.curPyramid == -1)
         {
-            //射线检测
-            Printf_error(
-                "光子初始位置不在mesh内部, emit需要射线检测, 此操作会耗费大量时间, 请尽量使用预设curPyramid\n");
-            float min_dist         = 1e10;
-            float min_dist_pyramid = -1;
-            for (int i = 0; i < m_mesh.pyramids.extent(0); i++)
-            {
-                auto result =
-                    IntersectionUtils::ray_pyramid_intersection(m_mesh.pyramids[i], m_photon.pos, m_photon.dir);
-                for (int j = 0; j < 4; j++)
-                {
-                    if (result.result[j].hit)
-                    {
-                        if (result.result[j].t < min_dist)
-                        {
-                            min_dist         = result.result[j].t;
-                            min_dist_pyramid = i;
-                        }
-                    }
-                }
-            }
-            if (min_dist_pyramid == -1)
+            // 光子初始位置不在mesh内部, 沿发射方向求与边界的第一个交点
+            Printf("光子初始位置不在mesh内部, 射线检测边界\n");
+            Scalar dist              = 0;
+            const Index entryPyramid = m_mesh.FirstBoundaryHit(m_photon.pos, m_photon.dir, &dist);
+            if (entryPyramid == -1)
             {
                 Printf_error("当前光子设置不与mesh相交, 请检查光子初始位置和方向\n");
                 return false;
             }
-            m_photon.curPyramid = min_dist_pyramid;
-            m_photon.pos        = m_photon.pos + m_photon.dir * min_dist;
+            m_photon.curPyramid = entryPyramid;
+            m_photon.pos        = m_photon.pos + m_photon.dir * dist;
         }
 
         return true;
     }
+    // 沿当前方向走到出射面, nextPyramid为负时表示光子将离开网格
     KOKKOS_INLINE_FUNCTION
     bool GetNextPyramid(Index* nextPyramid, Scalar* dist)
     {
         FUNCTION_LOG_GUARD;
-        auto& curPyramid = m_photon.curPyramid;
-        auto results =
-            IntersectionUtils::ray_pyramid_intersection(m_mesh.pyramids[curPyramid], m_photon.pos, m_photon.dir);
-
-        auto& result = results.result;
-        for (int i = 0; i < 4; i++)
+        if (m_photon.curPyramid < 0 || m_photon.curPyramid >= m_mesh.NumTets())
         {
-            if (result[i].hit && result[i].t > 0 && result[i].t > 1e6 * REALEPS)
-            {
-                Point intersection_point = m_photon.pos + m_photon.dir * result[i].t;
-                Point next_point_pos     = intersection_point + m_photon.dir * 0.1 * m_mesh.GetMinLength();
-                *dist                    = result[i].t;
-
-                auto& p1 = result[i].p1;
-                auto& p2 = result[i].p2;
-                auto& p3 = result[i].p3;
-                Face hitFace(p1, p2, p3);
-
-                if (result[i].type == 3)
-                {
-                    auto adjacentNum = m_mesh.adjacentPyramidsNum_3(m_photon.curPyramid);
-                    KOKKOS_ASSERT(adjacentNum < m_mesh.adjacentPyramids_3.extent(1));
-                    for (int j = 0; j < adjacentNum; j++)
-                    {
-                        auto& nextPyramid_ = m_mesh.adjacentPyramids_3(m_photon.curPyramid, j);
-                        if (m_mesh.pyramids[nextPyramid_].HasFace(hitFace))
-                        {
-                            *nextPyramid = nextPyramid_;
-                            return true;
-                        }
-                    }
-                }
-                else if (result[i].type == 2)
-                {
-                    auto adjacentNum = m_mesh.adjacentPyramidsNum_2(m_photon.curPyramid);
-                    KOKKOS_ASSERT(adjacentNum < m_mesh.adjacentPyramids_2.extent(1));
-                    auto adjacentP = m_mesh.adjacentPyramids_2(m_photon.curPyramid, adjacentNum);
-                    for (int j = 0; j < adjacentNum; j++)
-                    {
-                        auto& nextPyramid_ = m_mesh.adjacentPyramids_2(m_photon.curPyramid, j);
-                        if (m_mesh.pyramids[nextPyramid_].InPyramid(next_point_pos))
-                        {
-                            *nextPyramid = nextPyramid_;
-                            return true;
-                        }
-                    }
-                }
-                else if (result[i].type == 1)
-                {
-                    auto adjacentNum = m_mesh.adjacentPyramidsNum_1(m_photon.curPyramid);
-                    KOKKOS_ASSERT(adjacentNum < m_mesh.adjacentPyramids_1.extent(1));
-                    auto adjacentP = m_mesh.adjacentPyramids_1(m_photon.curPyramid, adjacentNum);
-                    for (int j = 0; j < adjacentNum; j++)
-                    {
-                        auto& nextPyramid_ = m_mesh.adjacentPyramids_1(m_photon.curPyramid, j);
-                        if (m_mesh.pyramids[nextPyramid_].InPyramid(next_point_pos))
-                        {
-                            *nextPyramid = nextPyramid_;
-                            return true;
-                        }
-                    }
-                }
-                else
-                {
-                    Kokkos::printf("Error: the type of the intersection is not 1, 2 or 3\n");
-                }
-
-                break;
-            }  // if (results(i).hit && results(i).t > 0 && results(i).t > REALEPS)
+            return false;
         }
-        return false;
+        TetWalk::Step step = TetWalk::Next(m_mesh, m_photon.curPyramid, m_photon.pos, m_photon.dir);
+        *nextPyramid       = step.nextTet;
+        *dist              = step.dist;
+        m_photon.nextFace  = step.face;
+        return true;
     }
     KOKKOS_INLINE_FUNCTION
-    bool MoveLen(float len)
+    bool MoveLen(Scalar len)
     {
         FUNCTION_LOG_GUARD;
         m_photon.pos.x += m_photon.dir.x * len;
@@ -295,96 +251,187 @@ class transpose_core
         return true;
     }
 
+    // 单次飞行的结果: 到达出射面、到达作用点、离开网格/被收集、出错
+    enum class FlightEvent
+    {
+        CROSS,
+        INTERACT,
+        EXIT,
+        ERROR
+    };
+    // 在当前四面体内前进len, 同时累计路径长度和飞行时间
     KOKKOS_INLINE_FUNCTION
-    bool Move()
+    void Advance(Scalar len)
+    {
+        if (m_spectral || m_options.recordPaths)
+        {
+            // 光谱模式各组在这一段的吸收按走这一段之前的路径计算
+            const int slot = SpectralSets::Slot(m_mesh.tetMaterials(m_photon.curPyramid));
+            if (m_spectral) m_spectral->Deposit(m_photon.curPyramid, slot, m_photon.weight, m_photon.path, len);
+            m_photon.path[slot] += len;
+        }
+        m_photon.Ps += len;
+        m_photon.time += len * m_mesh.GetMaterial(m_photon.curPyramid).invSpeed;
+        MoveLen(len);
+    }
+    KOKKOS_INLINE_FUNCTION
+    void Record(CollectType type, Index pyramidIndex)
+    {
+        result.type         = type;
+        result.pyramidIndex = pyramidIndex;
+        result.pos          = m_photon.pos;
+        result.dir          = m_photon.dir;
+        result.weight       = m_photon.weight;
+        result.Ps           = m_photon.Ps;
+        result.time         = m_photon.time;
+        if (m_spectral || m_options.recordPaths)
+        {
+            for (int d = 0; d < MAX_PATH_DOMAINS; d++)
+            {
+                result.path[d]     = m_photon.path[d];
+                result.scatters[d] = m_photon.scatters[d];
+            }
+        }
+    }
+    // 按当前四面体的衰减系数抽样自由程; 光谱模式只按散射系数抽样. 无衰减的域(如空气隙)中不发生作用, 直线穿过
+    KOKKOS_INLINE_FUNCTION
+    Scalar SampleStep()
+    {
+        const Material& material = m_mesh.GetMaterial(m_photon.curPyramid);
+        Printf("mua: %f, mus: %f, g: %f\n", material.mua, material.mus, material.g);
+        if (Clear(m_photon.curPyramid)) return REALMAX;
+        return SampleExponential(m_spectral ? material.invMus : material.invMut);
+    }
+    // 四面体所在的域是否无衰减: μt为0, 光谱模式下μs为0
+    KOKKOS_INLINE_FUNCTION
+    bool Clear(Index tet) const
+    {
+        const Material& material = m_mesh.GetMaterial(tet);
+        return (m_spectral ? material.mus : material.mut) <= 0;
+    }
+    // 处理界面(透射或反射)并更新剩余自由程: 进入无衰减的域时改为直线穿过,
+    // 从无衰减的域进入有衰减的域时按新域重新抽样, 其余情况沿用剩余的自由程
+    KOKKOS_INLINE_FUNCTION
+    void CrossFace(Scalar& s_)
+    {
+        const bool wasClear = Clear(m_photon.curPyramid);
+        DealWithFace();
+        if (Clear(m_photon.curPyramid))
+            s_ = REALMAX;
+        else if (wasClear)
+            s_ = SampleStep();
+    }
+    KOKKOS_INLINE_FUNCTION
+    Scalar SampleExponential(Scalar mean)
+    {
+        if (m_options.sampling == SamplingMode::FAST) return -(Scalar)FastMath::Log((float)GetRandom()) * mean;
+        return -Kokkos::log(GetRandom()) * mean;
+    }
+    // 沿当前方向飞行剩余步长s_, 直到出射面或作用点, 到达出射面时s_减去已走的距离
+    KOKKOS_INLINE_FUNCTION
+    FlightEvent Fly(Scalar& s_)
     {
         FUNCTION_LOG_GUARD;
-        Scalar s_;
-        const auto& pyr                    = m_mesh.pyramids;
-        const Pyramid::Attribute& cur_Attr = pyr[m_photon.curPyramid].value;
-        const Scalar& mua                  = cur_Attr.mua;
-        const Scalar& mus                  = cur_Attr.mus;
-        const Scalar& g                    = cur_Attr.g;
-        Printf("mua: %f, mus: %f, g: %f\n", mua, mus, g);
-        // move the photon
-        if (mua + mus > 0)
-        {
-            s_ = -log(GetRandom()) / (mua + mus);
+        Scalar dist = 0;
+        counters.Add(Counter::STEPS);
+        if (!GetNextPyramid(&m_photon.nextPyramid, &dist))
+        {
+            counters.Add(Counter::WALK_FAILURES);
+            m_photon.alive = false;
+            Kokkos::printf("[TetMesh ERROR] GetCollectType not completed\n");
+            return FlightEvent::ERROR;
+        }
+        Printf("m_photon.nextPyramid: %d\n", m_photon.nextPyramid);
+        const Scalar len = s_ > dist ? dist : s_;
+        if (m_photon.time + len * m_mesh.GetMaterial(m_photon.curPyramid).invSpeed > m_options.timeGate)
+        {
+            // 走完这一段已超出时间窗, 之后的出射和吸收都不再统计
+            Printf("超出时间窗, 终止光子\n");
+            m_photon.alive = false;
+            return FlightEvent::EXIT;
+        }
+        // 到达网格外边界(nextPyramid < 0)时同样返回CROSS, 由DealWithFace按与环境介质的Fresnel反射率反射或离开网格
+        auto nowCollectType = m_photon.nextPyramid < 0 ? CollectType::IGNORE
+                                                       : m_collectStrategy.GetCollectType(m_photon.nextPyramid);
+        switch (nowCollectType)
+        {
+            case CollectType::COLLECT:
+                m_photon.alive = false;
+                Record(CollectType::COLLECT, m_photon.nextPyramid);
+                return FlightEvent::EXIT;
+            case CollectType::OUTOFRANGE:
+                m_photon.alive = false;
+                Record(CollectType::OUTOFRANGE, m_photon.curPyramid);
+                return FlightEvent::EXIT;
+            case CollectType::IGNORE: break;
+            default: break;
+        }
+        FlightEvent event;
+        if (s_ > dist)
+        {
+            Advance(dist);
+            s_ -= dist;
+            event = FlightEvent::CROSS;
         }
         else
         {
-            s_ = 1;
+            Advance(s_);
+            s_    = 0;
+            event = FlightEvent::INTERACT;
         }
+        m_photon.max_z = m_photon.max_z > m_photon.pos.z ? m_photon.max_z : m_photon.pos.z;
+        return event;
+    }
+    // 在作用点按当前四面体的属性吸收并散射; 光谱模式的吸收已在Advance中沿路径计入
+    KOKKOS_INLINE_FUNCTION
+    void Interact()
+    {
+        const Material& material = m_mesh.GetMaterial(m_photon.curPyramid);
+        if (!m_spectral) Absorb(material);
+        if (m_spectral || m_options.recordPaths)
+        {
+            m_photon.scatters[SpectralSets::Slot(m_mesh.tetMaterials(m_photon.curPyramid))]++;
+        }
+        Scatter(material);
+    }
+
+    KOKKOS_INLINE_FUNCTION
+    bool Move()
+    {
+        FUNCTION_LOG_GUARD;
+        Scalar s_ = SampleStep();
         Printf("s_: %f\n", s_);
         int max_iter = MAX_ITER;
-        while (s_ >= 0 && m_photon.alive && max_iter--)
+        while (s_ > 0 && m_photon.alive && max_iter--)
         {
-            Scalar dist = 0;
-            if (!GetNextPyramid(&m_photon.nextPyramid, &dist))
-            {
-                m_photon.alive = false;
-                Kokkos::printf("[TetMesh ERROR] GetCollectType not completed\n");
-                return false;
-            }
-            Kokkos::printf("m_photon.nextPyramid: %d\n", m_photon.nextPyramid);
-            auto nowCollectType = m_collectStrategy.GetCollectType(m_photon.nextPyramid);
-            switch (nowCollectType)
+            switch (Fly(s_))
             {
-                case CollectType::COLLECT:
-                    m_photon.alive      = false;
-                    result.type         = CollectType::COLLECT;
-                    result.pyramidIndex = m_photon.nextPyramid;
-                    result.pos          = m_photon.pos;
-                    result.dir          = m_photon.dir;
-                    result.weight       = m_photon.weight;
-                    return true;
-                case CollectType::OUTOFRANGE:
-                    m_photon.alive = false;
-                    result.type    = CollectType::OUTOFRANGE;
-                    return true;
-                    break;
-                case CollectType::IGNORE: break;
-                default: break;
+                case FlightEvent::CROSS: CrossFace(s_); break;
+                case FlightEvent::INTERACT: Interact(); break;
+                case FlightEvent::EXIT: return true;
+                case FlightEvent::ERROR: return false;
             }
-            if (s_ > dist)
-            {
-                Kokkos::printf("%s\n", __LINE__);
-                m_photon.Ps += dist;
-                MoveLen(dist);
-                s_ -= dist;
-                m_photon.pos = m_photon.pos + m_photon.dir * dist;
-                DealWithFace();
-                Kokkos::printf("%s\n", __LINE__);
-            }
-            else
-            {
-                MoveLen(s_);
-                Kokkos::printf("%s\n", __LINE__);
-                m_photon.Ps += s_;
-                Absorb(mua, mus);
-                Kokkos::printf("%s\n", __LINE__);
-                Scatter(g);
-                s_ = 0;
-            }
-            m_photon.max_z = m_photon.max_z > m_photon.pos.z ? m_photon.max_z : m_photon.pos.z;
         }
-        Kokkos::printf("%s\n", __LINE__);
+        if (max_iter < 0) counters.Add(Counter::MOVE_LIMIT);
         return true;
     }
     KOKKOS_INLINE_FUNCTION
     bool Roulette()
     {
         FUNCTION_LOG_GUARD;
-        if (m_photon.weight < 0.0001)
+        // 光谱模式按各组中最大可能的权重判断
+        const Accum weight =
+            m_spectral ? m_photon.weight * m_spectral->MaxAttenuation(m_photon.path) : m_photon.weight;
+        if (weight < (Accum)0.0001)
         {
-            if (GetRandom(0, 1) > 0.1)
+            if (GetRandom(0, 1) > (Scalar)0.1)
             {
                 m_photon.alive = false;
                 return false;
             }
             else
             {
-                m_photon.weight /= 0.1;
+                m_photon.weight /= (Accum)0.1;
                 return true;
             }
         }
@@ -397,18 +444,43 @@ class transpose_core
     void Mirror()
     {
         FUNCTION_LOG_GUARD;
-        auto n     = m_photon.nextFace.normal();
-        float cdot = n.x * m_photon.dir.x + n.y * m_photon.dir.y + n.z * m_photon.dir.z;
-        m_photon.dir.x -= 2.0f * cdot * n.x;
-        m_photon.dir.y -= 2.0f * cdot * n.y;
-        m_photon.dir.z -= 2.0f * cdot * n.z;
+        counters.Add(Counter::REFLECTIONS);
+        auto n     = m_mesh.FaceNormal(m_photon.curPyramid, m_photon.nextFace);
+        Scalar cdot = n.x * m_photon.dir.x + n.y * m_photon.dir.y + n.z * m_photon.dir.z;
+        m_photon.dir.x -= 2 * cdot * n.x;
+        m_photon.dir.y -= 2 * cdot * n.y;
+        m_photon.dir.z -= 2 * cdot * n.z;
         m_photon.nextPyramid = m_photon.curPyramid;
     }
+    // 下一侧的折射率, 网格外边界的另一侧为环境介质(材料0)
     KOKKOS_INLINE_FUNCTION
-    void Transmit(float nipnt, float costhi, float costht, Point nor)
+    Scalar NextIndex() const
+    {
+        return m_photon.nextPyramid < 0 ? m_mesh.materials(0).n : m_mesh.GetMaterial(m_photon.nextPyramid).n;
+    }
+    // 透射到下一个四面体; 在网格外边界上则离开网格, 结果中的方向为出射前网格内的方向(探测器按折射后的方向判断接收角)
+    KOKKOS_INLINE_FUNCTION
+    void Enter()
+    {
+        if (m_photon.nextPyramid >= 0)
+        {
+            m_photon.curPyramid = m_photon.nextPyramid;
+            return;
+        }
+        m_photon.alive = false;
+        Record(CollectType::OUTOFRANGE, m_photon.curPyramid);
+        result.face = m_photon.nextFace;
+    }
+    KOKKOS_INLINE_FUNCTION
+    void Transmit(Scalar nipnt, Scalar costhi, Scalar costht, Point nor)
     {
         FUNCTION_LOG_GUARD;
-        if (costhi > 0.0)
+        if (m_photon.nextPyramid < 0)
+        {
+            Enter();
+            return;
+        }
+        if (costhi > 0)
         {
             m_photon.dir.x = nipnt * m_photon.dir.x + (nipnt * costhi - costht) * nor.x;
             m_photon.dir.y = nipnt * m_photon.dir.y + (nipnt * costhi - costht) * nor.y;
@@ -426,39 +498,52 @@ class transpose_core
     void DealWithFace()
     {
         FUNCTION_LOG_GUARD;
-        auto nor    = m_photon.nextFace.normal();
-        float n     = m_mesh.pyramids[m_photon.curPyramid].value.n;
-        float new_n = m_mesh.pyramids[m_photon.nextPyramid].value.n;
+        counters.Add(Counter::CROSSINGS);
+        if (m_options.fresnel == FresnelMode::TABLE)
+        {
+            DealWithFaceTable();
+            return;
+        }
+        auto nor    = m_mesh.FaceNormal(m_photon.curPyramid, m_photon.nextFace);
+        Scalar n     = m_mesh.GetMaterial(m_photon.curPyramid).n;
+        Scalar new_n = NextIndex();
 
-        float nipnt = n / new_n;
+        Scalar nipnt = n / new_n;
         if (nipnt == 1)
         {
-            m_photon.curPyramid = m_photon.nextPyramid;
+            Enter();
             return;
         }
-        float costhi = -(m_photon.dir.x * nor.x + m_photon.dir.y * nor.y + m_photon.dir.z * nor.z);
-        if (1.0 - powf(nipnt, 2) * (1.0 - powf(costhi, 2)) <= 0.0)
+        Scalar costhi = -(m_photon.dir.x * nor.x + m_photon.dir.y * nor.y + m_photon.dir.z * nor.z);
+        if (1 - nipnt * nipnt * (1 - costhi * costhi) <= 0)
         {
             Mirror();
             return;
         }
-        float costht = sqrtf(1.0f - powf(nipnt, 2) * (1.0f - powf(costhi, 2)));
-        float thi;
+        Scalar costht = Kokkos::sqrt(1 - nipnt * nipnt * (1 - costhi * costhi));
+        Scalar thi;
 
-        if (costhi > 0.0)
-            thi = acosf(costhi);
+        if (costhi > 0)
+            thi = Kokkos::acos(costhi);
         else
-            thi = acosf(-costhi);
+            thi = Kokkos::acos(-costhi);
 
-        float tht = acosf(costht);
-        float R;
+        Scalar tht = Kokkos::acos(costht);
+        Scalar R;
 
-        if (sinf(thi + tht) <= 1E-15)
-            R = powf((nipnt - 1.0f) / (nipnt + 1.0f), 2);
+        if (Kokkos::sin(thi + tht) <= REALEPS)
+        {
+            const Scalar r = (nipnt - 1) / (nipnt + 1);
+            R              = r * r;
+        }
         else
-            R = 0.5f * (powf(sinf(thi - tht) / sinf(thi + tht), 2) + powf(tanf(thi - tht) / tanf(thi + tht), 2));
+        {
+            const Scalar rs = Kokkos::sin(thi - tht) / Kokkos::sin(thi + tht);
+            const Scalar rp = Kokkos::tan(thi - tht) / Kokkos::tan(thi + tht);
+            R               = (rs * rs + rp * rp) / 2;
+        }
 
-        float xi = GetRandom();
+        Scalar xi = GetRandom();
 
         if (xi <= R)
         {
@@ -467,50 +552,87 @@ class transpose_core
         }
         Transmit(nipnt, costhi, costht, nor);
     }
+    // 与DealWithFace相同的判断顺序和随机数用量, 反射率改为查表, 不用三角函数和除法
     KOKKOS_INLINE_FUNCTION
-    bool Scatter(float g)
+    void DealWithFaceTable()
+    {
+        const FresnelTable& table = m_mesh.fresnel;
+        const uint8_t next        = m_photon.nextPyramid < 0 ? 0 : m_mesh.tetMaterials(m_photon.nextPyramid);
+        const int slot            = table.Slot(m_mesh.tetMaterials(m_photon.curPyramid), next);
+        if (slot < 0)
+        {
+            Enter();
+            return;
+        }
+        const FresnelTable::Interface& face = table.interfaces(slot);
+        auto nor          = m_mesh.FaceNormal(m_photon.curPyramid, m_photon.nextFace);
+        Scalar costhi      = -(m_photon.dir.x * nor.x + m_photon.dir.y * nor.y + m_photon.dir.z * nor.z);
+        const Scalar sint2 = face.nipnt2 * (1 - costhi * costhi);
+        if (sint2 >= 1)
+        {
+            Mirror();
+            return;
+        }
+        const Scalar costht = Kokkos::sqrt(1 - sint2);
+        if (GetRandom() <= table.Reflectance(face, Kokkos::fabs(costhi), costht))
+        {
+            Mirror();
+            return;
+        }
+        Transmit(face.nipnt, costhi, costht, nor);
+    }
+    KOKKOS_INLINE_FUNCTION
+    bool Scatter(const Material& material)
     {
         FUNCTION_LOG_GUARD;
-        float xi = 0, theta = 0, phi = 0;
-        auto g2 = g * g;
+        if (m_options.sampling == SamplingMode::FAST)
+        {
+            ScatterFast(material);
+            return true;
+        }
+        Scalar xi = 0, theta = 0, phi = 0;
+        const Scalar g  = material.g;
+        const Scalar g2 = material.g2;
 
         // Henye-Greenstein scattering
-        if (g != 0.0)
+        if (g != 0)
         {
             xi = GetRandom();
-            if ((0.0 < xi) && (xi < 1.0))
-                theta = (1.0f + g2 - powf((1.0f - g2) / (1.0f - g * (1.0f - 2.0f * xi)), 2)) / (2.0f * g);
+            if ((0 < xi) && (xi < 1))
+            {
+                const Scalar t = (1 - g2) / (1 - g * (1 - 2 * xi));
+                theta          = (1 + g2 - t * t) / (2 * g);
+            }
             else
-                theta = (1.0f - xi) * M_PI;
+                theta = 2 * xi - 1;  // 端点处cosθ取±1
         }
         else
-            theta = 2.0f * GetRandom() - 1.0f;
+            theta = 2 * GetRandom() - 1;
 
-        phi             = 2.0f * M_PI * GetRandom();
-        float& cosTheta = theta;
+        phi              = 2 * Kokkos::numbers::pi_v<Scalar> * GetRandom();
+        Scalar& cosTheta = theta;
         // Scatter the photon
-        float dxn, dyn, dzn;
-        float sinTheta = sqrtf(1 - cosTheta * cosTheta);
-        float sinPsi   = sinf(phi);
-        float cosPsi   = cosf(phi);
-        if (fabs(m_photon.dir.z) > 0.999f)
+        Scalar dxn, dyn, dzn;
+        Scalar sinTheta = Kokkos::sqrt(1 - cosTheta * cosTheta);
+        Scalar sinPsi   = Kokkos::sin(phi);
+        Scalar cosPsi   = Kokkos::cos(phi);
+        if (Kokkos::fabs(m_photon.dir.z) > (Scalar)0.999)
         {
             dxn = sinTheta * cosPsi;
             dyn = sinTheta * sinPsi;
-            dzn = m_photon.dir.z * cosTheta / fabs(m_photon.dir.z);
+            dzn = m_photon.dir.z * cosTheta / Kokkos::fabs(m_photon.dir.z);
         }
         else
         {
-            dxn = sinTheta * (m_photon.dir.x * m_photon.dir.z * cosPsi - m_photon.dir.y * sinPsi) /
-                      sqrtf(1.0f - m_photon.dir.z * m_photon.dir.z) +
+            const Scalar sinDir = Kokkos::sqrt(1 - m_photon.dir.z * m_photon.dir.z);
+            dxn = sinTheta * (m_photon.dir.x * m_photon.dir.z * cosPsi - m_photon.dir.y * sinPsi) / sinDir +
                   m_photon.dir.x * cosTheta;
-            dyn = sinTheta * (m_photon.dir.y * m_photon.dir.z * cosPsi + m_photon.dir.x * sinPsi) /
-                      sqrtf(1.0f - m_photon.dir.z * m_photon.dir.z) +
+            dyn = sinTheta * (m_photon.dir.y * m_photon.dir.z * cosPsi + m_photon.dir.x * sinPsi) / sinDir +
                   m_photon.dir.y * cosTheta;
-            dzn = -sinTheta * cosPsi * sqrtf(1.0f - m_photon.dir.z * m_photon.dir.z) + m_photon.dir.z * cosTheta;
+            dzn = -sinTheta * cosPsi * sinDir + m_photon.dir.z * cosTheta;
         }
 
-        float norm = sqrtf(dxn * dxn + dyn * dyn + dzn * dzn);
+        Scalar norm = Kokkos::sqrt(dxn * dxn + dyn * dyn + dzn * dzn);
         dxn /= norm;
         dyn /= norm;
         dzn /= norm;
@@ -520,12 +642,30 @@ class transpose_core
         m_photon.dir.z = dzn;
         return true;
     }
+    // 与Scatter相同的随机数用量和顺序: 先θ后φ
+    KOKKOS_INLINE_FUNCTION
+    void ScatterFast(const Material& material)
+    {
+        const Scalar xi = GetRandom();
+        Scalar cosTheta = 2 * xi - 1;
+        if (material.g != 0)
+        {
+            const Scalar t = 1 / (material.hgC + material.hgD * xi);
+            cosTheta       = material.hgA - material.hgB * t * t;
+        }
+        cosTheta              = Kokkos::clamp(cosTheta, (Scalar)-1, (Scalar)1);
+        const Scalar sinTheta = Kokkos::sqrt(1 - cosTheta * cosTheta);
+        float sinPhi, cosPhi;
+        FastMath::SinCos2Pi((float)GetRandom(), &sinPhi, &cosPhi);
+        m_photon.dir = FastMath::Rotate(m_photon.dir, cosTheta, sinTheta, cosPhi, sinPhi);
+    }
     KOKKOS_INLINE_FUNCTION
-    bool Absorb(float mua, float mus)
+    bool Absorb(const Material& material)
     {
         FUNCTION_LOG_GUARD;
-        float dwa = m_photon.weight * mua / (mus + mua);
+        Accum dwa = m_photon.weight * (Accum)(1 - material.albedo);
         m_photon.weight -= dwa;
+        if (m_tally) m_tally->Deposit(m_photon.curPyramid, dwa);
         return true;
     }
 };
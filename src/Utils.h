@@ -1,6 +1,7 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <limits>
 #include <Kokkos_Core.hpp>
 #include <Kokkos_Random.hpp>
 
@@ -16,15 +17,41 @@ using range_policy = Kokkos::RangePolicy<ExecSpace>;
 // 添加这一行定义 RandPool 类型
 typedef Kokkos::Random_XorShift64_Pool<> RandPool;
 
+// 精度策略: Geometry用于坐标、方向、步长和光学参数, Accum用于光子权重和所有累加量(吸收、出射、探测器直方图).
+// 编译时用宏选择, 同一份源码可以编译出三种实例:
+//   MC_PRECISION_FLOAT   全部float
+//   MC_PRECISION_DOUBLE  全部double
+//   缺省(MIXED)          几何float, 累加double
+template <class GeometryType, class AccumType>
+struct PrecisionPolicy
+{
+    using Geometry = GeometryType;
+    using Accum    = AccumType;
+};
+using FloatPrecision  = PrecisionPolicy<float, float>;
+using DoublePrecision = PrecisionPolicy<double, double>;
+using MixedPrecision  = PrecisionPolicy<float, double>;
+#if defined(MC_PRECISION_FLOAT)
+using Precision = FloatPrecision;
+#elif defined(MC_PRECISION_DOUBLE)
+using Precision = DoublePrecision;
+#else
+using Precision = MixedPrecision;
+#endif
+
 // all class need to be POD
-typedef float Scalar;
-constexpr Scalar REALMIN  = FLT_MIN;
-constexpr Scalar REALMAX  = FLT_MAX;
-constexpr Scalar REALEPS  = 1e-15;
+typedef Precision::Geometry Scalar;
+typedef Precision::Accum Accum;
+constexpr Scalar REALMIN  = std::numeric_limits<Scalar>::min();
+constexpr Scalar REALMAX  = std::numeric_limits<Scalar>::max();
+constexpr Scalar REALEPS  = std::numeric_limits<Scalar>::epsilon();
 constexpr Scalar NANVALUE = REALMIN;
+// 真空光速(mm/ns), 网格长度单位按mm计
+constexpr Scalar LIGHT_SPEED = (Scalar)299.792458;
+// 未设置的属性取NANVALUE, 与真正的nan一样视为无效
 KOKKOS_INLINE_FUNCTION
 bool IsNan(Scalar x){
-    return x <= NANVALUE+REALEPS || x >= NANVALUE-2;
+    return Kokkos::isnan(x) || x == NANVALUE;
 }
 typedef int Index;
 constexpr Index ILLEGAL_INDEX = std::numeric_limits<Index>::quiet_NaN();
@@ -38,7 +65,8 @@ typedef struct Vec3f
     KOKKOS_INLINE_FUNCTION
     bool operator==(const Vec3f &p) const
     {
-        return (x - p.x) * (x - p.x) < REALEPS && (y - p.y) * (y - p.y) < REALEPS && (z - p.z) * (z - p.z) < REALEPS;
+        constexpr Scalar tol = REALEPS * REALEPS;
+        return (x - p.x) * (x - p.x) < tol && (y - p.y) * (y - p.y) < tol && (z - p.z) * (z - p.z) < tol;
     }
     KOKKOS_INLINE_FUNCTION
     Vec3f operator+(const Vec3f &p) const { 
@@ -73,7 +101,7 @@ typedef struct Vec3f
         return res;
          }
     KOKKOS_INLINE_FUNCTION
-    double dot(const Vec3f &p) const { return x * p.x + y * p.y + z * p.z; }
+    Scalar dot(const Vec3f &p) const { return x * p.x + y * p.y + z * p.z; }
     KOKKOS_INLINE_FUNCTION
         Vec3f cross(const Vec3f &p) const { 
         Vec3f res;
@@ -83,10 +111,19 @@ typedef struct Vec3f
         return res;
          }
     KOKKOS_INLINE_FUNCTION
-    double norm() const { return sqrt(x * x + y * y + z * z); }
+    Scalar norm() const { return Kokkos::sqrt(x * x + y * y + z * z); }
     KOKKOS_INLINE_FUNCTION
     Vec3f normalize() { return *this / norm(); }
 } Vec3f;
+// 四面体的4个顶点索引, 16字节对齐使一次加载即可取到整个四面体
+typedef struct alignas(16) Index4
+{
+    Index v[4] = {-1, -1, -1, -1};
+    KOKKOS_INLINE_FUNCTION
+    Index &operator[](int i) { return v[i]; }
+    KOKKOS_INLINE_FUNCTION
+    const Index &operator[](int i) const { return v[i]; }
+} Index4;
 
 typedef typename Kokkos::Random_XorShift64_Pool<ExecSpace> RandPoolType;
 constexpr unsigned int MAX_ITER = 100;
@@ -0,0 +1,362 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+#include <utility>
+#include "Source.h"
+
+// 光子状态的结构体数组(SoA)队列, 各字段按光子编号连续存储
+typedef struct PhotonQueue
+{
+    Kokkos::View<Point *, ExecSpace> pos;
+    Kokkos::View<Vec3f *, ExecSpace> dir;
+    Kokkos::View<Accum *, ExecSpace> weight;
+    Kokkos::View<Scalar *, ExecSpace> max_z;
+    Kokkos::View<Scalar *, ExecSpace> Ps;
+    Kokkos::View<Scalar *, ExecSpace> time;
+    Kokkos::View<Index *, ExecSpace> curPyramid;
+    Kokkos::View<Index *, ExecSpace> nextPyramid;
+    Kokkos::View<int8_t *, ExecSpace> nextFace;
+    Kokkos::View<int8_t *, ExecSpace> alive;
+    Kokkos::View<Scalar *, ExecSpace> step;     // 本次Move剩余的自由程, 0 表示需要重新抽样
+    Kokkos::View<int *, ExecSpace> crossings;   // 本次Move剩余可穿过的面数
+    Kokkos::View<int *, ExecSpace> moves;       // 剩余的Move次数
+    Kokkos::View<int8_t *, ExecSpace> event;    // 上一个阶段留下的事件, 决定下一个阶段是否处理该光子
+    Kokkos::View<uint64_t *, ExecSpace> draws;  // 已取的随机数个数, 与种子和光子编号一起恢复随机数流
+    // 光谱模式或记录路径时各域的路径长度和散射次数, 否则为空
+    Kokkos::View<Scalar *[MAX_PATH_DOMAINS], ExecSpace> path;
+    Kokkos::View<uint32_t *[MAX_PATH_DOMAINS], ExecSpace> scatters;
+
+    PhotonQueue() = default;
+    explicit PhotonQueue(size_t n, bool paths = false)
+        : pos("wf_pos", n),
+          dir("wf_dir", n),
+          weight("wf_weight", n),
+          max_z("wf_max_z", n),
+          Ps("wf_Ps", n),
+          time("wf_time", n),
+          curPyramid("wf_curPyramid", n),
+          nextPyramid("wf_nextPyramid", n),
+          nextFace("wf_nextFace", n),
+          alive("wf_alive", n),
+          step("wf_step", n),
+          crossings("wf_crossings", n),
+          moves("wf_moves", n),
+          event("wf_event", n),
+          draws("wf_draws", n),
+          path("wf_path", paths ? n : 0),
+          scatters("wf_scatters", paths ? n : 0)
+    {
+    }
+    KOKKOS_INLINE_FUNCTION
+    void Load(Index i, Photon3D &photon) const
+    {
+        photon.pos         = pos(i);
+        photon.dir         = dir(i);
+        photon.weight      = weight(i);
+        photon.max_z       = max_z(i);
+        photon.Ps          = Ps(i);
+        photon.time        = time(i);
+        photon.curPyramid  = curPyramid(i);
+        photon.nextPyramid = nextPyramid(i);
+        photon.nextFace    = nextFace(i);
+        photon.alive       = alive(i) != 0;
+        if (path.extent(0) == 0) return;
+        for (int d = 0; d < MAX_PATH_DOMAINS; d++)
+        {
+            photon.path[d]     = path(i, d);
+            photon.scatters[d] = scatters(i, d);
+        }
+    }
+    KOKKOS_INLINE_FUNCTION
+    void Store(Index i, const Photon3D &photon) const
+    {
+        pos(i)         = photon.pos;
+        dir(i)         = photon.dir;
+        weight(i)      = photon.weight;
+        max_z(i)       = photon.max_z;
+        Ps(i)          = photon.Ps;
+        time(i)        = photon.time;
+        curPyramid(i)  = photon.curPyramid;
+        nextPyramid(i) = photon.nextPyramid;
+        nextFace(i)    = (int8_t)photon.nextFace;
+        alive(i)       = photon.alive ? 1 : 0;
+        if (path.extent(0) == 0) return;
+        for (int d = 0; d < MAX_PATH_DOMAINS; d++)
+        {
+            path(i, d)     = photon.path[d];
+            scatters(i, d) = photon.scatters[d];
+        }
+    }
+} PhotonQueue;
+
+// 事件驱动(wavefront)的传输引擎
+// 与transpose_core::run逐光子跑完整个循环不同, 每一轮把所有存活光子依次送过
+// 飞行 -> 界面 -> 吸收/散射 -> 轮盘赌 四个kernel, 每个kernel只处理带有对应事件的光子,
+// 轮末压缩存活光子列表, 并每隔sortInterval轮按curPyramid分桶排序, 使同一四面体的光子相邻访问网格.
+// 物理过程直接复用transpose_core的Fly/DealWithFace/Interact/Roulette, 结果与逐光子版本一致.
+template <class Collect = TetLabelCollect>
+class WavefrontEngine
+{
+   public:
+    enum Event : int8_t
+    {
+        FLY      = 0,
+        CROSS    = 1,
+        INTERACT = 2,
+        ROULETTE = 3,
+        DONE     = 4
+    };
+    int sortInterval = 4;        // 每隔几轮按四面体分桶, <=0 时不排序
+    Index maxBins    = 1 << 16;  // 分桶数上限, 相邻编号的四面体共用一个桶
+    TransportOptions options;    // 时间门/界面反射率/抽样方式
+    SpectralSets spectral;       // 非空时为光谱模式
+    TransportCounters counters;  // 热路径计数, 各次run累加; 未定义MC_INSTRUMENT时保持为0
+
+    WavefrontEngine(const TetMesh &mesh, const Collect &collectStrategy, uint64_t seed,
+                    const AbsorptionTally &tally)
+        : m_mesh(mesh), m_collectStrategy(collectStrategy), m_seed(seed), m_tally(tally)
+    {
+    }
+
+    // 传输results.extent(0)个光子, 结果写入results; 第i个光子的全局编号为firstPhoton + i,
+    // 初始状态为StartPhoton(source, i), source为单个Photon3D或逐光子的Photon3D数组.
+    // log为true时使用单光子跟踪的实例
+    template <class ResultView, class SourceT>
+    int run(const ResultView &results, const SourceT &source, bool log = false, uint64_t firstPhoton = 0)
+    {
+        return log ? Transport<TraceLevel::PHOTON>(results, source, firstPhoton)
+                   : Transport<TraceLevel::NONE>(results, source, firstPhoton);
+    }
+
+   private:
+    const TetMesh &m_mesh;
+    const Collect &m_collectStrategy;
+    uint64_t m_seed;
+    const AbsorptionTally &m_tally;
+    PhotonQueue m_queue;
+    Kokkos::View<Index *, ExecSpace> m_active;  // 存活光子的编号
+    Kokkos::View<Index *, ExecSpace> m_next;    // 压缩/排序的输出缓冲, 与m_active交替使用
+    Kokkos::View<Index *, ExecSpace> m_bins;
+
+    template <TraceLevel trace, class ResultView, class SourceT>
+    int Transport(const ResultView &results, const SourceT &source, uint64_t firstPhoton)
+    {
+        const Index n = (Index)results.extent(0);
+        if (n == 0) return 0;
+        const bool hasPath = spectral.Enabled() || options.recordPaths;
+        if ((Index)m_queue.pos.extent(0) < n || (m_queue.path.extent(0) > 0) != hasPath)
+        {
+            m_queue  = PhotonQueue(n, hasPath);
+            m_active = Kokkos::View<Index *, ExecSpace>("wf_active", n);
+            m_next   = Kokkos::View<Index *, ExecSpace>("wf_next", n);
+        }
+        const TetMesh mesh                     = m_mesh;
+        const Collect strategy                 = m_collectStrategy;
+        const uint64_t seed                    = m_seed;
+        const PhotonQueue queue                = m_queue;
+        auto active                            = m_active;
+
+        CountedFor(
+            "wf_emit", Kokkos::RangePolicy<ExecSpace>(0, n),
+            KOKKOS_LAMBDA(const Index i, Counters &localCounters)
+            {
+                transpose_core<trace, Collect> core(mesh, strategy, PhiloxRandom(seed, firstPhoton + i));
+                core.m_photon = StartPhoton(source, i);
+                core.counters.Add(Counter::PHOTONS);
+                const bool emitted = core.Emit();
+                if (emitted) core.CheckInit();
+                core.m_photon.alive = emitted;
+                queue.Store(i, core.m_photon);
+                queue.draws(i)     = core.m_random.Draws();
+                queue.step(i)      = 0;
+                queue.crossings(i) = 0;
+                queue.moves(i)     = MAX_ITER;
+                queue.event(i)     = emitted ? FLY : DONE;
+                results(i)         = core.result;
+                active(i)          = i;
+                localCounters += core.counters;
+            },
+            counters);
+
+        // 去掉不与网格相交的光子
+        Index numActive = Compact(n);
+        int rounds      = 0;
+        while (numActive > 0)
+        {
+            if (sortInterval > 0 && rounds % sortInterval == 0) SortByTet(numActive);
+            Fly<trace>(results, numActive, firstPhoton);
+            Stage<trace, CROSS>(results, numActive, firstPhoton);
+            Stage<trace, INTERACT>(results, numActive, firstPhoton);
+            Stage<trace, ROULETTE>(results, numActive, firstPhoton);
+            numActive = Compact(numActive);
+            rounds++;
+        }
+        return rounds;
+    }
+
+    // 飞行: 必要时抽样新的自由程, 走到出射面或作用点
+    template <TraceLevel trace, class ResultView>
+    void Fly(const ResultView &results, Index numActive, uint64_t firstPhoton)
+    {
+        using Core                             = transpose_core<trace, Collect>;
+        const TetMesh mesh                     = m_mesh;
+        const Collect strategy                 = m_collectStrategy;
+        const uint64_t seed                    = m_seed;
+        const PhotonQueue queue                = m_queue;
+        auto active                            = m_active;
+        const TransportOptions options_        = options;
+        const SpectralSets spectral_           = spectral;
+        CountedFor(
+            "wf_fly", Kokkos::RangePolicy<ExecSpace>(0, numActive),
+            KOKKOS_LAMBDA(const Index k, Counters &localCounters)
+            {
+                const Index i = active(k);
+                Core core(mesh, strategy, PhiloxRandom(seed, firstPhoton + i, queue.draws(i)));
+                core.set_options(options_);
+                core.set_spectral(spectral_);
+                queue.Load(i, core.m_photon);
+                Scalar s_ = queue.step(i);
+                if (s_ <= 0)
+                {
+                    s_                 = core.SampleStep();
+                    queue.crossings(i) = MAX_ITER;
+                }
+                queue.crossings(i)--;
+                switch (core.Fly(s_))
+                {
+                    case Core::FlightEvent::CROSS: queue.event(i) = CROSS; break;
+                    case Core::FlightEvent::INTERACT: queue.event(i) = INTERACT; break;
+                    default:
+                        queue.event(i) = DONE;
+                        results(i)     = core.result;
+                        break;
+                }
+                queue.step(i)  = s_;
+                queue.draws(i) = core.m_random.Draws();
+                queue.Store(i, core.m_photon);
+                localCounters += core.counters;
+            },
+            counters);
+    }
+    // 界面/作用点/轮盘赌各自一个kernel, 只处理事件为stage的光子
+    template <TraceLevel trace, int stage, class ResultView>
+    void Stage(const ResultView &results, Index numActive, uint64_t firstPhoton)
+    {
+        using Core                             = transpose_core<trace, Collect>;
+        const TetMesh mesh                     = m_mesh;
+        const Collect strategy                 = m_collectStrategy;
+        const uint64_t seed                    = m_seed;
+        const AbsorptionTally tally            = m_tally;
+        const TransportOptions options_        = options;
+        const SpectralSets spectral_           = spectral;
+        const PhotonQueue queue                = m_queue;
+        auto active                            = m_active;
+        const char *label = stage == CROSS ? "wf_interface" : (stage == INTERACT ? "wf_interact" : "wf_roulette");
+        CountedFor(
+            label, Kokkos::RangePolicy<ExecSpace>(0, numActive),
+            KOKKOS_LAMBDA(const Index k, Counters &localCounters)
+            {
+                const Index i = active(k);
+                if (queue.event(i) != stage) return;
+                Core core(mesh, strategy, PhiloxRandom(seed, firstPhoton + i, queue.draws(i)));
+                core.set_tally(tally);
+                core.set_options(options_);
+                core.set_spectral(spectral_);
+                queue.Load(i, core.m_photon);
+                int8_t next = FLY;
+                if (stage == CROSS)
+                {
+                    Scalar s_ = queue.step(i);
+                    core.CrossFace(s_);
+                    queue.step(i) = s_;
+                    // 与Move一致: 自由程用完或穿面次数用完时结束本次Move
+                    if (queue.step(i) <= 0 || queue.crossings(i) <= 0)
+                    {
+                        if (queue.step(i) > 0) core.counters.Add(Counter::MOVE_LIMIT);
+                        queue.step(i) = 0;
+                        next          = ROULETTE;
+                    }
+                }
+                else if (stage == INTERACT)
+                {
+                    core.Interact();
+                    next = ROULETTE;
+                }
+                else
+                {
+                    core.Roulette();
+                    if (--queue.moves(i) <= 0 && core.m_photon.alive)
+                    {
+                        core.m_photon.alive = false;
+                        core.counters.Add(Counter::RUN_LIMIT);
+                    }
+                }
+                if (!core.m_photon.alive)
+                {
+                    next       = DONE;
+                    results(i) = core.result;
+                }
+                queue.event(i) = next;
+                queue.draws(i) = core.m_random.Draws();
+                queue.Store(i, core.m_photon);
+                localCounters += core.counters;
+            },
+            counters);
+    }
+    // 用前缀和把存活光子压缩到列表前部, 返回存活数
+    Index Compact(Index numActive)
+    {
+        const PhotonQueue queue = m_queue;
+        auto active             = m_active;
+        auto next               = m_next;
+        Index count             = 0;
+        Kokkos::parallel_scan(
+            "wf_compact", Kokkos::RangePolicy<ExecSpace>(0, numActive),
+            KOKKOS_LAMBDA(const Index k, Index &offset, const bool final)
+            {
+                const Index i   = active(k);
+                const bool keep = queue.alive(i) != 0 && queue.event(i) != DONE;
+                if (keep && final) next(offset) = i;
+                if (keep) offset++;
+            },
+            count);
+        std::swap(m_active, m_next);
+        return count;
+    }
+    // 按curPyramid计数排序(分桶): 计数 -> 前缀和 -> 原子分配位置
+    void SortByTet(Index numActive)
+    {
+        const Index numTets = m_mesh.NumTets();
+        const Index numBins = numTets < maxBins ? numTets : maxBins;
+        if (numBins <= 1 || numActive <= 1) return;
+        if ((Index)m_bins.extent(0) < numBins + 1) m_bins = Kokkos::View<Index *, ExecSpace>("wf_bins", numBins + 1);
+        const PhotonQueue queue = m_queue;
+        auto active             = m_active;
+        auto next               = m_next;
+        auto bins               = m_bins;
+        auto binOf              = KOKKOS_LAMBDA(Index tet)
+        {
+            return (Index)(((int64_t)tet * numBins) / numTets);
+        };
+        Kokkos::deep_copy(bins, 0);
+        Kokkos::parallel_for(
+            "wf_bin_count", Kokkos::RangePolicy<ExecSpace>(0, numActive),
+            KOKKOS_LAMBDA(const Index k) { Kokkos::atomic_inc(&bins(binOf(queue.curPyramid(active(k))))); });
+        Kokkos::parallel_scan(
+            "wf_bin_offsets", Kokkos::RangePolicy<ExecSpace>(0, numBins),
+            KOKKOS_LAMBDA(const Index b, Index &offset, const bool final)
+            {
+                const Index c = bins(b);
+                if (final) bins(b) = offset;
+                offset += c;
+            });
+        Kokkos::parallel_for(
+            "wf_bin_scatter", Kokkos::RangePolicy<ExecSpace>(0, numActive),
+            KOKKOS_LAMBDA(const Index k)
+            {
+                const Index i = active(k);
+                next(Kokkos::atomic_fetch_add(&bins(binOf(queue.curPyramid(i))), 1)) = i;
+            });
+        std::swap(m_active, m_next);
+    }
+};
+#endif
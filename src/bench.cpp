@@ -0,0 +1,385 @@
+#include <Kokkos_Core.hpp>
+#include <cmath>
+#include <cstdlib>
+#include <utility>
+#include <vector>
+#include "Utils.h"
+#include "Geometry.h"
+#include "Run.h"
+#include "MeshGenerator.h"
+
+// 抽样基准的矩: 自由程s, 散射角余弦c的一阶、二阶(及方差所需的)矩, 以及多次散射后方向长度的偏离
+typedef struct SampleMoments
+{
+    double n = 0, s = 0, s2 = 0, c = 0, c2 = 0, c4 = 0, drift = 0;
+    KOKKOS_INLINE_FUNCTION
+    SampleMoments& operator+=(const SampleMoments& o)
+    {
+        n += o.n;
+        s += o.s;
+        s2 += o.s2;
+        c += o.c;
+        c2 += o.c2;
+        c4 += o.c4;
+        drift += o.drift;
+        return *this;
+    }
+} SampleMoments;
+namespace Kokkos
+{
+template <>
+struct reduction_identity<SampleMoments>
+{
+    KOKKOS_FORCEINLINE_FUNCTION static SampleMoments sum() { return SampleMoments(); }
+};
+}  // namespace Kokkos
+
+// 从边界离开的光子按weight(result)计的平均出射权重
+template <class ResultView, class Weight>
+static double EscapedWeight(const ResultView& results, const Weight& weight)
+{
+    Accum escaped = 0;
+    Kokkos::parallel_reduce(
+        "bench_escaped_weight", Kokkos::RangePolicy<ExecSpace>(0, results.extent(0)),
+        KOKKOS_LAMBDA(const int i, Accum& local)
+        {
+            if (results(i).type == CollectType::OUTOFRANGE) local += weight(results(i));
+        },
+        escaped);
+    return (double)escaped / results.extent(0);
+}
+
+// 网格遍历基准: 从随机四面体的重心沿随机方向出发, 逐个穿过四面体直到离开网格
+// 用法: bench [mesh.vol] [num_rays]; bench_float/bench_double为另外两种精度策略编译的同一程序
+// 另外比较随机数生成方式, 逐光子(megakernel)与分阶段(wavefront)两种传输引擎, 各种吸收统计方式、界面反射率查表的开销,
+// 光谱模式与逐组运行的对比, 重放与重新传输的对比以及各种光源的抽样
+int main(int argc, char* argv[])
+{
+    Kokkos::ScopeGuard scope_guard(argc, argv);
+    const char* mesh_path = argc > 1 ? argv[1] : "data/MultiLayers.vol";
+    const int num_rays    = argc > 2 ? std::atoi(argv[2]) : 100000;
+    Kokkos::printf("DefaultExecutionSpace: %s\n", ExecSpace::name());
+    Kokkos::printf("precision: geometry %s, accumulator %s\n", sizeof(Scalar) == sizeof(float) ? "float" : "double",
+                   sizeof(Accum) == sizeof(float) ? "float" : "double");
+
+    Kokkos::Timer initTimer;
+    TetMesh mesh(mesh_path);
+    Kokkos::printf("mesh init: %.3f s\n", initTimer.seconds());
+
+    // 旧布局每个四面体存4个顶点 + 4个面(各3个顶点) + 属性(4个float)
+    const double legacy_bytes = (4 + 4 * 3) * sizeof(Point) + sizeof(Attribute);
+    const double bytes        = (double)mesh.GeometryBytes() / mesh.NumTets();
+    Kokkos::printf("tets: %d vertices: %d\n", mesh.NumTets(), (int)mesh.vertices.extent(0));
+    Kokkos::printf("bytes/tet: %.1f (legacy fat Pyramid: %.1f)\n", bytes, legacy_bytes);
+
+    TetLabelCollect strategy(mesh);
+    auto rand_pool = RandPoolType(12345);
+    const Index numTets = mesh.NumTets();
+
+    Kokkos::Timer timer;
+    long steps = 0;
+    Kokkos::parallel_reduce(
+        "bench_traverse", Kokkos::RangePolicy<ExecSpace>(0, num_rays),
+        KOKKOS_LAMBDA(const int i, long& localSteps)
+        {
+            auto state = rand_pool.get_state();
+            transpose_core<> core(mesh, strategy, PhiloxRandom(12345, i));
+            Index tet = (Index)(state.urand64() % numTets);
+            const Pyramid pyramid = mesh.GetPyramid(tet);
+            core.m_photon.pos     = (pyramid.p1 + pyramid.p2 + pyramid.p3 + pyramid.p4) / 4;
+            Scalar cost           = 2 * (Scalar)state.frand() - 1;
+            Scalar phi            = 2 * Kokkos::numbers::pi_v<Scalar> * (Scalar)state.frand();
+            Scalar sint           = Kokkos::sqrt(1 - cost * cost);
+            core.m_photon.dir     = Vec3f{sint * Kokkos::cos(phi), sint * Kokkos::sin(phi), cost};
+            core.m_photon.curPyramid = tet;
+            rand_pool.free_state(state);
+            for (int step = 0; step < (int)MAX_ITER; step++)
+            {
+                Scalar dist = 0;
+                if (!core.GetNextPyramid(&core.m_photon.nextPyramid, &dist)) break;
+                core.MoveLen(dist);
+                localSteps++;
+                if (core.m_photon.nextPyramid < 0) break;
+                core.m_photon.curPyramid = core.m_photon.nextPyramid;
+            }
+        },
+        steps);
+    Kokkos::fence();
+    double seconds = timer.seconds();
+    Kokkos::printf("traversal: %d rays, %ld steps, %.3f s, %.2f Msteps/s\n", num_rays, steps, seconds,
+                   steps / seconds * 1e-6);
+
+    // 起始四面体定位: 随机四面体内的随机点经空间索引查找
+    timer.reset();
+    int located = 0;
+    Kokkos::parallel_reduce(
+        "bench_locate", Kokkos::RangePolicy<ExecSpace>(0, num_rays),
+        KOKKOS_LAMBDA(const int, int& localLocated)
+        {
+            auto state            = rand_pool.get_state();
+            Index tet             = (Index)(state.urand64() % numTets);
+            const Pyramid pyramid = mesh.GetPyramid(tet);
+            Scalar w[4], sum = 0;
+            for (int k = 0; k < 4; k++) sum += (w[k] = state.frand() + 1e-3f);
+            rand_pool.free_state(state);
+            Point p = (pyramid.p1 * w[0] + pyramid.p2 * w[1] + pyramid.p3 * w[2] + pyramid.p4 * w[3]) / sum;
+            if (mesh.LocateTet(p) >= 0) localLocated++;
+        },
+        located);
+    Kokkos::fence();
+    seconds = timer.seconds();
+    Kokkos::printf("locate: %d queries, %d found, %.3f s, %.2f Mqueries/s (BVH %.1f MB)\n", num_rays, located, seconds,
+                   num_rays / seconds * 1e-6, (mesh.tetTree.Bytes() + mesh.boundaryTree.Bytes()) / 1e6);
+
+    // 随机数: 每次从池中取/还状态 vs 计数器随机数, 每个线程取draws个
+    const int draws = 64;
+    for (int philox = 0; philox < 2; philox++)
+    {
+        timer.reset();
+        double sum = 0;
+        Kokkos::parallel_reduce(
+            "bench_random", Kokkos::RangePolicy<ExecSpace>(0, num_rays),
+            KOKKOS_LAMBDA(const int i, double& localSum)
+            {
+                PhiloxRandom random(12345, i);
+                for (int k = 0; k < draws; k++)
+                {
+                    if (philox)
+                    {
+                        localSum += (double)random.Uniform();
+                    }
+                    else
+                    {
+                        auto state = rand_pool.get_state();
+                        localSum += state.drand();
+                        rand_pool.free_state(state);
+                    }
+                }
+            },
+            sum);
+        Kokkos::fence();
+        seconds = timer.seconds();
+        Kokkos::printf("random %-10s: %.3f s, %.1f Mdraws/s, mean %.4f\n", philox ? "philox" : "pool", seconds,
+                       (double)num_rays * draws / seconds * 1e-6, sum / ((double)num_rays * draws));
+    }
+
+    // 传输引擎对比: 均匀介质, 从网格包围盒中心沿+z发射
+    mesh.SetUniformMaterial(Attribute{0.1f, 10.0f, 0.9f, 1.37f});
+    Photon3D source;
+    auto root  = Kokkos::create_mirror_view_and_copy(Kokkos::HostSpace(), mesh.tetTree.nodes);
+    source.pos = root(0).box.Center();
+    Kokkos::View<resultType*, ExecSpace> results("results", num_rays);
+    for (Engine engine : {Engine::MEGAKERNEL, Engine::WAVEFRONT})
+    {
+        timer.reset();
+        const TransportCounters counters =
+            Run::Transport(mesh, strategy, 12345, AbsorptionTally(), results, source, engine);
+        Kokkos::fence();
+        seconds     = timer.seconds();
+        int escaped = 0;
+        Kokkos::parallel_reduce(
+            "bench_escaped", Kokkos::RangePolicy<ExecSpace>(0, num_rays),
+            KOKKOS_LAMBDA(const int i, int& localEscaped)
+            {
+                if (results(i).type == CollectType::OUTOFRANGE) localEscaped++;
+            },
+            escaped);
+        Kokkos::printf("transport %-10s: %d photons, %.3f s, %.3f Mphotons/s, escaped %.4f\n",
+                       engine == Engine::WAVEFRONT ? "wavefront" : "megakernel", num_rays, seconds,
+                       num_rays / seconds * 1e-6, (double)escaped / num_rays);
+        if constexpr (INSTRUMENT) counters.Print();
+    }
+
+    // 抽样方式: 逐个抽样自由程和散射方向, 与理论矩比较, z为偏差除以标准误差.
+    // 均匀介质中 E[s] = 1/μt, HG相函数 E[cosθ] = g, E[cos²θ] = (1 + 2g²)/3.
+    // 两种方式使用同一组随机数, 两行之差即为FAST引入的偏差
+    const Material material = mesh.GetMaterial(0);
+    const int samples       = 16;
+    for (SamplingMode mode : {SamplingMode::EXACT, SamplingMode::FAST})
+    {
+        timer.reset();
+        SampleMoments m;
+        Kokkos::parallel_reduce(
+            "bench_sampling", Kokkos::RangePolicy<ExecSpace>(0, num_rays),
+            KOKKOS_LAMBDA(const int i, SampleMoments& local)
+            {
+                transpose_core<> core(mesh, strategy, PhiloxRandom(12345, i));
+                TransportOptions options;
+                options.sampling = mode;
+                core.set_options(options);
+                core.m_photon.curPyramid = 0;
+                core.m_photon.dir        = Vec3f{0, 0, 1};
+                for (int k = 0; k < samples; k++)
+                {
+                    const double step = core.SampleStep();
+                    const Vec3f dir   = core.m_photon.dir;
+                    core.Scatter(material);
+                    const double cosTheta = dir.dot(core.m_photon.dir);
+                    local.n += 1;
+                    local.s += step;
+                    local.s2 += step * step;
+                    local.c += cosTheta;
+                    local.c2 += cosTheta * cosTheta;
+                    local.c4 += cosTheta * cosTheta * cosTheta * cosTheta;
+                }
+                local.drift += (double)Kokkos::fabs(core.m_photon.dir.norm() - 1);
+            },
+            m);
+        Kokkos::fence();
+        seconds         = timer.seconds();
+        const double g  = material.g;
+        const double s  = m.s / m.n, c = m.c / m.n, c2 = m.c2 / m.n;
+        auto z          = [&](double mean, double meanSquare, double expected)
+        { return (mean - expected) / Kokkos::sqrt((meanSquare - mean * mean) / m.n); };
+        Kokkos::printf("sampling %-5s: %.1f Msamples/s, E[s] %.5f (z %+.2f), E[cos] %.5f (z %+.2f), "
+                       "E[cos2] %.5f (z %+.2f), |dir| drift %.1e\n",
+                       mode == SamplingMode::FAST ? "fast" : "exact", m.n / seconds * 1e-6, s,
+                       z(s, m.s2 / m.n, 1 / (double)material.mut), c, z(c, c2, g), c2,
+                       z(c2, m.c4 / m.n, (1 + 2 * g * g) / 3), m.drift / num_rays);
+    }
+
+    // 吸收统计的开销: 不统计 / 原子加 / ScatterView / 热点混合
+    double baseline = 0;
+    for (auto mode : {AbsorptionTally::Mode::NONE, AbsorptionTally::Mode::ATOMIC, AbsorptionTally::Mode::SCATTER,
+                      AbsorptionTally::Mode::HYBRID})
+    {
+        AbsorptionTally tally(mesh, mode);
+        tally.SetHotRegion(mesh, source.pos, AbsorptionTally::DEFAULT_HOT_TETS);
+        timer.reset();
+        Run::Transport(mesh, strategy, 12345, tally, results, source, Engine::MEGAKERNEL);
+        tally.Finalize();
+        Kokkos::fence();
+        seconds = timer.seconds();
+        if (mode == AbsorptionTally::Mode::NONE) baseline = seconds;
+        double deposited = 0;
+        auto absorbed    = tally.absorbed;
+        Kokkos::parallel_reduce(
+            "bench_deposited", Kokkos::RangePolicy<ExecSpace>(0, absorbed.extent(0)),
+            KOKKOS_LAMBDA(const int i, double& local) { local += (double)absorbed(i); }, deposited);
+        Kokkos::printf("absorption tally %-8s: %.3f s (%+.1f%%), deposited %.4f per photon\n",
+                       AbsorptionTally::ModeName(mode), seconds, (seconds / baseline - 1) * 100, deposited / num_rays);
+    }
+
+    // 界面反射率: 逐次计算 vs 查表. 输入网格可能只有一个域(没有界面), 改用5层的合成平板,
+    // 相邻层的折射率交替取1.37/1.5, 共4个内部界面; 两种方式的出射权重应只差查表的插值误差
+    {
+        TetMesh slab(MeshGenerator::Slab(50000, {2, 2, 2, 2, 2}, 20), "fresnel_slab");
+        std::vector<Attribute> layered(6, Attribute{0.1f, 10.0f, 0.9f, 1.37f});
+        for (int d = 2; d < (int)layered.size(); d += 2) layered[d].n = 1.5f;
+        layered[0] = MaterialTable::Ambient();
+        slab.SetMaterials(layered);
+        TetLabelCollect slabStrategy(slab);
+        Photon3D slabSource;
+        auto slabRoot  = Kokkos::create_mirror_view_and_copy(Kokkos::HostSpace(), slab.tetTree.nodes);
+        slabSource.pos = slabRoot(0).box.Center();
+        Kokkos::printf("fresnel: 4 interfaces, %d tables, resolution %d, max interpolation error %.2g\n",
+                       (int)slab.fresnel.NumInterfaces(), slab.fresnel.resolution, (double)slab.fresnel.MaxError());
+        for (FresnelMode mode : {FresnelMode::EXACT, FresnelMode::TABLE})
+        {
+            timer.reset();
+            TransportOptions options;
+            options.fresnel = mode;
+            Run::Transport(slab, slabStrategy, 12345, AbsorptionTally(), results, slabSource, Engine::MEGAKERNEL,
+                           false, options);
+            Kokkos::fence();
+            seconds = timer.seconds();
+            Kokkos::printf("fresnel %-6s: %.3f s, %.3f Mphotons/s, escaped weight %.6f\n",
+                           mode == FresnelMode::TABLE ? "table" : "exact", seconds, num_rays / seconds * 1e-6,
+                           EscapedWeight(results, DetectorSet::ResultWeight()));
+        }
+    }
+
+    // 光谱模式: numSets组只有μa不同的材料, 共用一次行走 vs 逐组单独传输, 比较时间和每组的出射权重
+    const int numSets = 16;
+    std::vector<std::vector<Attribute>> sets(numSets);
+    for (int k = 0; k < numSets; k++)
+    {
+        const Scalar mua = (Scalar)(0.005 * std::pow(100.0, (double)k / (numSets - 1)));
+        sets[k].assign(MaterialTable::MAX_MATERIALS, Attribute{mua, 10.0f, 0.9f, 1.37f});
+        sets[k][0] = MaterialTable::Ambient();
+    }
+    mesh.SetMaterials(sets[0]);
+    const SpectralSets spectral(mesh, sets, false);
+    timer.reset();
+    Run::Transport(mesh, strategy, 12345, AbsorptionTally(), results, source, Engine::MEGAKERNEL, false,
+                   TransportOptions(), 0, spectral);
+    Kokkos::fence();
+    const double shared = timer.seconds();
+    std::vector<double> sharedEscaped(numSets);
+    for (int k = 0; k < numSets; k++) sharedEscaped[k] = EscapedWeight(results, SetWeight{spectral, k});
+    double separate = 0, maxDiff = 0;
+    for (int k = 0; k < numSets; k++)
+    {
+        mesh.SetMaterials(sets[k]);
+        timer.reset();
+        Run::Transport(mesh, strategy, 12345, AbsorptionTally(), results, source, Engine::MEGAKERNEL);
+        Kokkos::fence();
+        separate += timer.seconds();
+        maxDiff = std::fmax(maxDiff, std::fabs(EscapedWeight(results, DetectorSet::ResultWeight()) - sharedEscaped[k]));
+    }
+    Kokkos::printf("spectral %d sets: shared walk %.3f s, separate runs %.3f s (%.1fx), escaped weight %.4f..%.4f, "
+                   "max diff vs separate %.4f\n",
+                   numSets, shared, separate, separate / shared, sharedEscaped[numSets - 1], sharedEscaped[0], maxDiff);
+
+    // 微扰/重放: 记录被探测光子的各域路径长度和散射次数, 按μa最大的一组重新加权, 与用该组重新传输比较
+    const DetectorSet detected({Detector{}});
+    TransportOptions recordOptions;
+    recordOptions.recordPaths = true;
+    mesh.SetMaterials(sets[0]);
+    timer.reset();
+    Run::Transport(mesh, strategy, 12345, AbsorptionTally(), results, source, Engine::MEGAKERNEL, false,
+                   recordOptions);
+    ReplayBuffer replay(mesh, detected);
+    replay.Capture(mesh, results, 12345, 0, DetectorSet::ResultWeight());
+    Kokkos::fence();
+    const double recorded = timer.seconds();
+    timer.reset();
+    const ReplayResult reweighted = replay.Reweight(sets[numSets - 1]);
+    const double reweight = timer.seconds();
+    DetectorSet rerun = detected.Clone();
+    mesh.SetMaterials(sets[numSets - 1]);
+    Run::Transport(mesh, strategy, 12345, AbsorptionTally(), results, source, Engine::MEGAKERNEL);
+    rerun.Accumulate(mesh, results);
+    Kokkos::printf("replay: %zu records (%.1f MB), transport+record %.3f s, reweight %.4f s, "
+                   "signal %.4f vs rerun %.4f per photon\n",
+                   replay.Size(), replay.Bytes() / 1e6, recorded, reweight, reweighted.signal[0] / num_rays,
+                   rerun.Bin(0, 0) / num_rays);
+
+    // 光源: 按批抽样位置和方向并解析起始四面体, 光束从网格包围盒下方沿+z射入, 各向同性点光源在包围盒中心;
+    // setup为host上的一次性预处理, candidates为-1表示该类候选未使用(点光源或候选过多时退回BVH)
+    const AABB box     = root(0).box;
+    const Vec3f extent = box.hi - box.lo;
+    const Scalar spot  = (Scalar)0.1 * Kokkos::fmin(extent.x, extent.y);
+    const Point below{box.Center().x, box.Center().y, box.lo.z - extent.z / 10};
+    const Vec3f up{0, 0, 1};
+    const std::pair<const char*, Source> sources[] = {
+        {"pencil", Source::Pencil(below, up)},
+        {"gaussian", Source::Gaussian(below, up, spot)},
+        {"disk", Source::Disk(below, up, spot)},
+        {"isotropic", Source::Isotropic(box.Center())},
+        {"planar", Source::Planar(below - Vec3f{spot, spot, 0}, Vec3f{2 * spot, 0, 0}, Vec3f{0, 2 * spot, 0}, up)}};
+    Kokkos::View<Photon3D*, ExecSpace> starts("starts", num_rays);
+    for (const auto& [name, src] : sources)
+    {
+        timer.reset();
+        const SourceSampler sampler(mesh, src);
+        const double setup = timer.seconds();
+        timer.reset();
+        sampler.Sample(mesh, 12345, 0, starts);
+        Kokkos::fence();
+        seconds     = timer.seconds();
+        int entered = 0;
+        Kokkos::parallel_reduce(
+            "bench_entered", Kokkos::RangePolicy<ExecSpace>(0, num_rays),
+            KOKKOS_LAMBDA(const int i, int& localEntered) { localEntered += starts(i).alive ? 1 : 0; }, entered);
+        timer.reset();
+        Run::Transport(mesh, strategy, 12345, AbsorptionTally(), results, starts, Engine::MEGAKERNEL);
+        Kokkos::fence();
+        const double transport = timer.seconds();
+        Kokkos::printf("source %-9s: setup %.4f s, %.1f Msamples/s, entered %.4f, candidates %d tets %d faces, "
+                       "transport %.3f Mphotons/s\n",
+                       name, setup, num_rays / seconds * 1e-6, (double)entered / num_rays, sampler.NumCandidateTets(),
+                       sampler.NumCandidateFaces(), num_rays / transport * 1e-6);
+    }
+    return 0;
+}
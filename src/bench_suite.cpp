@@ -0,0 +1,274 @@
+#include <Kokkos_Core.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "Utils.h"
+#include "MeshGenerator.h"
+#include "Run.h"
+
+// 合成网格基准: 按给定的四面体数生成层状平板和同心球网格, 测量网格加载、邻接表构建、传输吞吐量、走行步数和吸收统计开销.
+// 每次运行只测当前编译的后端和Kokkos线程数, 结果以一行JSON追加到输出文件(JSON Lines), 便于比较不同版本;
+// 遍历所有后端和线程数见 benchSuite.sh.
+// 用法: bench_suite [--tets 1000,10000,...] [--shapes slab,sphere] [--photons N] [--out file] [--label text] [--tmp dir]
+
+// 一种网格形状及其材料布局, 第l层为域l + 1
+typedef struct Layout
+{
+    std::string shape;
+    std::vector<Scalar> sizes;  // 平板: 各层厚度; 球: 各层外半径(mm)
+    std::vector<Attribute> layers;
+} Layout;
+
+// 只需要扁平的键值, 手写即可
+class JsonObject
+{
+   public:
+    JsonObject &Add(const char *key, double value)
+    {
+        char buffer[64];
+        std::snprintf(buffer, sizeof(buffer), "%.6g", value);
+        return Raw(key, buffer);
+    }
+    JsonObject &Add(const char *key, const std::string &value)
+    {
+        std::string quoted = "\"";
+        for (char c : value)
+        {
+            if (c == '"' || c == '\\') quoted += '\\';
+            quoted += c;
+        }
+        return Raw(key, quoted + "\"");
+    }
+    JsonObject &Raw(const char *key, const std::string &json)
+    {
+        m_text += (m_text.empty() ? "" : ", ") + std::string("\"") + key + "\": " + json;
+        return *this;
+    }
+    std::string Str() const { return "{" + m_text + "}"; }
+
+   private:
+    std::string m_text;
+};
+
+static std::vector<std::string> Split(const std::string &list)
+{
+    std::vector<std::string> items;
+    std::stringstream stream(list);
+    for (std::string item; std::getline(stream, item, ',');)
+    {
+        if (!item.empty()) items.push_back(item);
+    }
+    return items;
+}
+
+static NetgenReader::Result Generate(const Layout &layout, size_t tets)
+{
+    if (layout.shape == "slab") return MeshGenerator::Slab(tets, layout.sizes, 20);
+    return MeshGenerator::Sphere(tets, layout.sizes);
+}
+
+// 从随机四面体的重心沿随机方向出发逐个穿过四面体直到离开网格, 返回总步数
+static long Traverse(const TetMesh &mesh, const TetLabelCollect &strategy, int numRays)
+{
+    const Index numTets = mesh.NumTets();
+    long steps          = 0;
+    Kokkos::parallel_reduce(
+        "suite_traverse", Kokkos::RangePolicy<ExecSpace>(0, numRays),
+        KOKKOS_LAMBDA(const int i, long &localSteps)
+        {
+            PhiloxRandom random(2024, i);
+            transpose_core<> core(mesh, strategy, PhiloxRandom(12345, i));
+            const Index tet       = (Index)(random.Next() % (uint32_t)numTets);
+            const Pyramid pyramid = mesh.GetPyramid(tet);
+            const Scalar cost     = 2 * random.Uniform() - 1;
+            const Scalar phi      = 2 * Kokkos::numbers::pi_v<Scalar> * random.Uniform();
+            const Scalar sint     = Kokkos::sqrt(1 - cost * cost);
+            core.m_photon.pos     = (pyramid.p1 + pyramid.p2 + pyramid.p3 + pyramid.p4) / 4;
+            core.m_photon.dir     = Vec3f{sint * Kokkos::cos(phi), sint * Kokkos::sin(phi), cost};
+            core.m_photon.curPyramid = tet;
+            // 最长的路径穿过的四面体数与每个方向上的格子数同阶, MAX_ITER对大网格不够
+            for (Index step = 0; step < numTets; step++)
+            {
+                Scalar dist = 0;
+                if (!core.GetNextPyramid(&core.m_photon.nextPyramid, &dist)) break;
+                core.MoveLen(dist);
+                localSteps++;
+                if (core.m_photon.nextPyramid < 0) break;
+                core.m_photon.curPyramid = core.m_photon.nextPyramid;
+            }
+        },
+        steps);
+    Kokkos::fence();
+    return steps;
+}
+
+static std::string RunOne(const Layout &layout, size_t targetTets, int numPhotons, const std::filesystem::path &tmp)
+{
+    JsonObject json;
+    json.Add("shape", layout.shape).Add("target_tets", (double)targetTets).Add("layers", (double)layout.layers.size());
+
+    Kokkos::Timer timer;
+    NetgenReader::Result generated = Generate(layout, targetTets);
+    json.Add("generate_s", timer.seconds());
+    const std::string name    = "mc_bench_" + layout.shape + "_" + std::to_string(targetTets) + ".vol";
+    const std::string volPath = (tmp / name).string();
+    MeshGenerator::WriteNetgen(generated, volPath);
+    json.Add("vol_mb", std::filesystem::file_size(volPath) / 1e6);
+    generated = NetgenReader::Result();
+
+    // 与TetMesh::Init相同的步骤, 分别计时
+    TetMesh mesh;
+    timer.reset();
+    mesh.load_from_file(volPath);
+    Kokkos::fence();
+    json.Add("load_s", timer.seconds());
+    timer.reset();
+    mesh.buildNeighbors();
+    Kokkos::fence();
+    json.Add("adjacency_s", timer.seconds());
+    timer.reset();
+    mesh.buildSpatialIndex();
+    mesh.requireMinLength();
+    Kokkos::fence();
+    json.Add("spatial_index_s", timer.seconds());
+    const std::string cachePath = MeshCacheFile::PathFor(volPath);
+    timer.reset();
+    mesh.SaveCache(cachePath);
+    json.Add("cache_save_s", timer.seconds());
+    {
+        TetMesh cached;
+        timer.reset();
+        const bool ok = cached.LoadCache(cachePath);
+        Kokkos::fence();
+        json.Add("cache_load_s", ok ? timer.seconds() : -1.0);
+    }
+    std::filesystem::remove(volPath);
+    std::filesystem::remove(cachePath);
+
+    std::vector<Attribute> byDomain(layout.layers.size() + 1);
+    byDomain[0] = MaterialTable::Ambient();
+    std::copy(layout.layers.begin(), layout.layers.end(), byDomain.begin() + 1);
+    mesh.SetMaterials(byDomain);
+    json.Add("tets", mesh.NumTets()).Add("vertices", (double)mesh.vertices.extent(0));
+    json.Add("bytes_per_tet", (double)mesh.GeometryBytes() / mesh.NumTets());
+
+    TetLabelCollect strategy(mesh);
+    timer.reset();
+    const long steps     = Traverse(mesh, strategy, numPhotons);
+    const double seconds = timer.seconds();
+    json.Add("traversal_steps", (double)steps).Add("traversal_msteps_per_s", steps / seconds * 1e-6);
+
+    // 从网格包围盒中心发射, 平板为中间层内, 球为球心
+    Photon3D source;
+    auto root  = Kokkos::create_mirror_view_and_copy(Kokkos::HostSpace(), mesh.tetTree.nodes);
+    source.pos = root(0).box.Center();
+    Kokkos::View<resultType *, ExecSpace> results("results", numPhotons);
+    for (Engine engine : {Engine::MEGAKERNEL, Engine::WAVEFRONT})
+    {
+        timer.reset();
+        Run::Transport(mesh, strategy, 12345, AbsorptionTally(), results, source, engine);
+        Kokkos::fence();
+        json.Add(engine == Engine::WAVEFRONT ? "wavefront_mphotons_per_s" : "megakernel_mphotons_per_s",
+                 numPhotons / timer.seconds() * 1e-6);
+    }
+
+    // 吸收统计的开销, 相对于不统计的megakernel; auto为当前后端和网格大小下的默认方式
+    double baseline = 0;
+    for (auto mode : {AbsorptionTally::Mode::NONE, AbsorptionTally::Mode::ATOMIC, AbsorptionTally::Mode::AUTO})
+    {
+        AbsorptionTally tally(mesh, mode);
+        if (tally.mode == AbsorptionTally::Mode::HYBRID)
+        {
+            tally.SetHotRegion(mesh, source.pos, AbsorptionTally::DEFAULT_HOT_TETS);
+        }
+        timer.reset();
+        Run::Transport(mesh, strategy, 12345, tally, results, source, Engine::MEGAKERNEL);
+        tally.Finalize();
+        Kokkos::fence();
+        const double t = timer.seconds();
+        if (mode == AbsorptionTally::Mode::NONE)
+        {
+            baseline = t;
+            json.Add("tally_none_s", t);
+            continue;
+        }
+        const std::string key = mode == AbsorptionTally::Mode::AUTO ? "tally_auto" : "tally_atomic";
+        json.Add((key + "_s").c_str(), t).Add((key + "_overhead").c_str(), t / baseline - 1);
+        if (mode == AbsorptionTally::Mode::AUTO) json.Add("tally_auto_mode", AbsorptionTally::ModeName(tally.mode));
+    }
+    return json.Str();
+}
+
+int main(int argc, char *argv[])
+{
+    Kokkos::ScopeGuard scope_guard(argc, argv);
+    std::vector<std::string> tets = {"1000", "10000", "100000", "1000000"};
+    std::vector<std::string> shapes = {"slab", "sphere"};
+    int numPhotons                  = 100000;
+    std::string out                 = "bench_suite.jsonl";
+    std::string label;
+    std::filesystem::path tmp = std::filesystem::temp_directory_path();
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string arg = argv[i];
+        if (arg.rfind("--kokkos", 0) == 0) continue;
+        if (i + 1 >= argc)
+        {
+            std::fprintf(stderr, "参数%s缺少取值\n", arg.c_str());
+            return 1;
+        }
+        const std::string value = argv[++i];
+        if (arg == "--tets") tets = Split(value);
+        else if (arg == "--shapes") shapes = Split(value);
+        else if (arg == "--photons") numPhotons = std::atoi(value.c_str());
+        else if (arg == "--out") out = value;
+        else if (arg == "--label") label = value;
+        else if (arg == "--tmp") tmp = value;
+        else
+        {
+            std::fprintf(stderr, "未知参数: %s\n", arg.c_str());
+            return 1;
+        }
+    }
+    const std::vector<Attribute> tissue = {Attribute{0.1f, 10.0f, 0.9f, 1.37f}, Attribute{0.02f, 12.0f, 0.9f, 1.4f},
+                                           Attribute{0.01f, 8.0f, 0.85f, 1.44f}};
+    const std::vector<Layout> layouts   = {Layout{"slab", {1, 2, 7}, tissue}, Layout{"sphere", {5, 8, 10}, tissue}};
+
+    JsonObject run;
+    run.Add("label", label).Add("backend", ExecSpace::name()).Add("threads", ExecSpace().concurrency());
+    run.Add("precision_geometry", sizeof(Scalar) == sizeof(float) ? "float" : "double");
+    run.Add("precision_accum", sizeof(Accum) == sizeof(float) ? "float" : "double");
+    run.Add("photons", numPhotons);
+    std::string results;
+    for (const std::string &shape : shapes)
+    {
+        auto layout = std::find_if(layouts.begin(), layouts.end(), [&](const Layout &l) { return l.shape == shape; });
+        if (layout == layouts.end())
+        {
+            std::fprintf(stderr, "未知的网格形状: %s\n", shape.c_str());
+            return 1;
+        }
+        for (const std::string &n : tets)
+        {
+            const std::string result = RunOne(*layout, (size_t)std::atof(n.c_str()), numPhotons, tmp);
+            Kokkos::printf("%s\n", result.c_str());
+            results += (results.empty() ? "" : ", ") + result;
+        }
+    }
+    run.Raw("results", "[" + results + "]");
+
+    FILE *file = std::fopen(out.c_str(), "a");
+    if (!file)
+    {
+        std::fprintf(stderr, "无法写入%s\n", out.c_str());
+        return 1;
+    }
+    std::fprintf(file, "%s\n", run.Str().c_str());
+    std::fclose(file);
+    Kokkos::printf("%s %d threads: 结果已追加到%s\n", ExecSpace::name(), ExecSpace().concurrency(), out.c_str());
+    return 0;
+}
@@ -0,0 +1,116 @@
+#include <mpi.h>
+#include <Kokkos_Core.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <string>
+#include "Utils.h"
+#include "Distributed.h"
+
+// 多进程驱动: 每个rank一个Kokkos执行空间, 光子按全局编号均分, 统计用MPI_Reduce求和到rank 0
+// 用法: mpirun -np <ranks> mc_mpi [mesh.vol] [photons] [--batch N] [--checkpoint N] [--seed S]
+//       [--engine megakernel|wavefront]
+// 同一个种子下任意rank数的计数相同, 权重和直方图只差浮点求和顺序带来的舍入
+static int Main(int argc, char *argv[])
+{
+    int rank = 0;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    std::string mesh_path = "data/MultiLayers.vol";
+    uint64_t numPhotons   = 1000000;
+    uint64_t batch        = 1 << 20;
+    uint64_t checkpoint   = 0;
+    uint64_t seed         = rank == 0 ? (uint64_t)time(NULL) : 0;
+    Engine engine         = Engine::MEGAKERNEL;
+    int positional        = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string arg = argv[i];
+        if (arg.rfind("--kokkos", 0) == 0) continue;
+        if (arg.rfind("--", 0) != 0)
+        {
+            if (positional == 0) mesh_path = arg;
+            else numPhotons = std::strtoull(arg.c_str(), nullptr, 10);
+            positional++;
+            continue;
+        }
+        if (i + 1 >= argc)
+        {
+            if (rank == 0) std::fprintf(stderr, "参数%s缺少取值\n", arg.c_str());
+            return 1;
+        }
+        const std::string value = argv[++i];
+        if (arg == "--batch") batch = std::strtoull(value.c_str(), nullptr, 10);
+        else if (arg == "--checkpoint") checkpoint = std::strtoull(value.c_str(), nullptr, 10);
+        else if (arg == "--seed") seed = std::strtoull(value.c_str(), nullptr, 10);
+        else if (arg == "--engine") engine = value == "wavefront" ? Engine::WAVEFRONT : Engine::MEGAKERNEL;
+        else
+        {
+            if (rank == 0) std::fprintf(stderr, "未知参数: %s\n", arg.c_str());
+            return 1;
+        }
+    }
+    // 未指定种子时所有rank使用rank 0的时间种子
+    MPI_Bcast(&seed, 1, MPI_UINT64_T, 0, MPI_COMM_WORLD);
+
+    Kokkos::Timer initTimer;
+    DistributedRun distributed(MPI_COMM_WORLD, mesh_path.c_str());
+    Run &run = distributed.Local();
+    MPI_Barrier(MPI_COMM_WORLD);
+    if (rank == 0)
+    {
+        Kokkos::printf("ranks: %d, DefaultExecutionSpace: %s, concurrency per rank: %d\n", distributed.Size(),
+                       ExecSpace::name(), ExecSpace().concurrency());
+        Kokkos::printf("mesh init: %.3f s, tets: %d, seed: %llu\n", initTimer.seconds(), run.Mesh().NumTets(),
+                       (unsigned long long)seed);
+    }
+
+    // 从网格包围盒中心沿+z发射, 探测器接收所有出射光子并按出射半径分格
+    Photon3D source;
+    auto root  = Kokkos::create_mirror_view_and_copy(Kokkos::HostSpace(), run.Mesh().tetTree.nodes);
+    source.pos = root(0).box.Center();
+    Detector detector;
+    detector.center  = source.pos;
+    detector.rMax    = 10;
+    detector.numBins = 20;
+    run.SetDetectors({detector});
+    run.EnableAbsorptionTally();
+
+    Kokkos::Timer timer;
+    const DistributedTally tally = distributed.run_batched(
+        numPhotons, batch, seed, engine, source, checkpoint,
+        [&](const DistributedTally &t)
+        {
+            Kokkos::printf("checkpoint: %llu / %llu photons, out of range weight %.6f, %.3f s\n",
+                           (unsigned long long)t.photons, (unsigned long long)numPhotons,
+                           (double)t.run.outOfRangeWeight / t.photons, timer.seconds());
+        });
+    const double seconds = timer.seconds();
+    if (rank != 0) return 0;
+
+    double histogram = 0, absorbed = 0;
+    for (Accum w : tally.detectors) histogram += w;
+    for (Accum w : tally.absorbed) absorbed += w;
+    Kokkos::printf("photons: %llu, collected: %llu, out of range: %llu, ignored: %llu\n",
+                   (unsigned long long)tally.run.photons, (unsigned long long)tally.run.collected,
+                   (unsigned long long)tally.run.outOfRange, (unsigned long long)tally.run.ignored);
+    Kokkos::printf("weight per photon: collected %.6f, out of range %.6f, absorbed %.9f, detector %.9f\n",
+                   (double)tally.run.collectedWeight / tally.run.photons,
+                   (double)tally.run.outOfRangeWeight / tally.run.photons, absorbed / tally.run.photons,
+                   histogram / tally.run.photons);
+    Kokkos::printf("transport: %.3f s, %.2f Mphotons/s, load balance (slowest / fastest rank): %.3f / %.3f s\n",
+                   seconds, tally.run.photons / seconds * 1e-6, tally.slowestSeconds, tally.fastestSeconds);
+    if (INSTRUMENT) tally.counters.Print();
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    MPI_Init(&argc, &argv);
+    int status = 0;
+    {
+        Kokkos::ScopeGuard scope_guard(argc, argv);
+        status = Main(argc, argv);
+    }
+    MPI_Finalize();
+    return status;
+}